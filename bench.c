@@ -0,0 +1,206 @@
+#include <sync.h>
+#include <files-list.h>
+#include <file-properties.h>
+#include <configuration.h>
+#include <processes.h>
+#include <utility.h>
+#include <stats.h>
+#include <defines.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Each benchmark prints one JSON object per line, so that results can be compared by scripts:
+// {"benchmark": name, "items": count, "bytes": count, "seconds": duration}
+
+/*!
+ * @brief now gives the current time of the monotonic clock
+ * @return the time in seconds
+ */
+static double now(void) {
+    return monotonic_ns() / 1e9;
+}
+
+/*!
+ * @brief report prints the result of a benchmark
+ * @param name is the name of the benchmark
+ * @param items is the number of processed items (entries, lookups, etc.)
+ * @param bytes is the number of processed bytes, 0 if not relevant
+ * @param seconds is the duration of the benchmark
+ */
+static void report(char *name, uint64_t items, uint64_t bytes, double seconds) {
+    printf("{\"benchmark\": \"%s\", \"items\": %lu, \"bytes\": %lu, \"seconds\": %.6f, \"items_per_second\": %.1f, \"gb_per_second\": %.4f}\n",
+           name, (unsigned long) items, (unsigned long) bytes, seconds, seconds > 0 ? items / seconds : 0.0, seconds > 0 ? bytes / seconds / 1e9 : 0.0);
+    fflush(stdout);
+}
+
+/*!
+ * @brief files_bytes sums the sizes of the files of a list
+ * @param list is a pointer to the list
+ * @param files_count receives the number of files
+ * @return the total size of the files
+ */
+static uint64_t files_bytes(files_list_t *list, uint64_t *files_count) {
+    uint64_t bytes = 0;
+    *files_count = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            bytes += cursor->size;
+            ++*files_count;
+        }
+    }
+    return bytes;
+}
+
+/*!
+ * @brief drop_cached_files drops the files of a list from the page cache, so that they are read from the storage
+ * @param list is a pointer to the list
+ */
+static void drop_cached_files(files_list_t *list) {
+    // dirty pages (e.g. of the files just generated) can't be dropped before they are written
+    sync();
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            int fd = open(cursor->path_and_name, O_RDONLY);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief bench_synchronize runs and times a complete sequential synchronization
+ * The files and bytes copied (by copy or reflink) are counted with the statistics of the run.
+ * @param name is the name of the scenario
+ * @param source is the source directory
+ * @param destination is the destination directory
+ */
+static void bench_synchronize(char *name, char *source, char *destination) {
+    configuration_t the_config;
+    process_context_t p_context;
+    init_configuration(&the_config);
+    memset(&p_context, 0, sizeof(p_context));
+    the_config.is_parallel = false;
+    strcpy(the_config.source, source);
+    strcpy(the_config.destination, destination);
+    mkdir(destination, 0755);
+
+    stats_t run_stats;
+    memset(&run_stats, 0, sizeof(run_stats));
+    stats_attach(&run_stats);
+    double start = now();
+    synchronize(&the_config, &p_context);
+    double seconds = now() - start;
+    stats_attach(NULL);
+    report(name, run_stats.counters[STAT_FILES_COPIED] + run_stats.counters[STAT_FILES_CLONED],
+           run_stats.counters[STAT_BYTES_COPIED_SENDFILE] + run_stats.counters[STAT_BYTES_COPIED_REFLINK], seconds);
+}
+
+/*!
+ * @brief main function of the benchmarks
+ * It runs micro benchmarks of each stage of a synchronization (listing, stats, hashing, comparison, copy), then
+ * end to end scenarios. The trees are made by lp25-gen-tree (@see the bench target of the Makefile).
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, -1 else
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        printf("%s source_dir mirror_dir scratch_dir\n", argv[0]);
+        printf("mirror_dir is a synchronized copy of source_dir, then partially modified (@see lp25-gen-tree --mirror)\n");
+        return -1;
+    }
+    char *source = argv[1];
+    char *mirror = argv[2];
+    char *scratch = argv[3];
+    char path[PATH_SIZE];
+    files_list_t source_list = {NULL, NULL};
+    files_list_t mirror_list = {NULL, NULL};
+    uint64_t files_count, bytes, count;
+    double start;
+    mkdir(scratch, 0755);
+
+    // Listing (make_list, paths only)
+    start = now();
+    make_list(&source_list, source);
+    count = 0;
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        ++count;
+    }
+    report("list", count, 0, now() - start);
+
+    // Stats and MD5 of all the files (get_file_stats)
+    start = now();
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        get_file_stats(cursor);
+    }
+    bytes = files_bytes(&source_list, &files_count);
+    report("stats", files_count, bytes, now() - start);
+
+    // MD5 only, read from the storage, then from the page cache
+    drop_cached_files(&source_list);
+    start = now();
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            compute_file_md5(cursor);
+        }
+    }
+    report("hash", files_count, bytes, now() - start);
+    start = now();
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            compute_file_md5(cursor);
+        }
+    }
+    report("hash_warm", files_count, bytes, now() - start);
+
+    // Comparison of the source and mirror lists, with the index of the mirror contents (make_differences_list)
+    configuration_t the_config;
+    init_configuration(&the_config);
+    strcpy(the_config.source, source);
+    strcpy(the_config.destination, mirror);
+    make_files_list(&mirror_list, mirror);
+    count = 0;
+    for (files_list_entry_t *cursor = mirror_list.head; cursor != NULL; cursor = cursor->next) {
+        ++count;
+    }
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        ++count;
+    }
+    files_list_t differences_list = {NULL, NULL};
+    digest_index_t mirror_index;
+    bool uses_index = init_digest_index(&mirror_index, 0) == 0;
+    start = now();
+    make_differences_list(&the_config, &source_list, &mirror_list, &differences_list, uses_index ? &mirror_index : NULL);
+    report("diff", count, 0, now() - start);
+    if (uses_index) {
+        clear_digest_index(&mirror_index);
+    }
+    clear_files_list(&differences_list);
+
+    // Copy of all the entries into an empty directory
+    if (concat_path(the_config.destination, scratch, "copy") == NULL) {
+        return -1;
+    }
+    mkdir(the_config.destination, 0755);
+    start = now();
+    for (files_list_entry_t *cursor = source_list.head; cursor != NULL; cursor = cursor->next) {
+        copy_entry_to_destination(cursor, &the_config);
+    }
+    report("copy", files_count, bytes, now() - start);
+    clear_files_list(&source_list);
+    clear_files_list(&mirror_list);
+
+    // End to end scenarios
+    bench_synchronize("sync_modified", source, mirror);
+    bench_synchronize("sync_unchanged", source, mirror);
+    if (concat_path(path, scratch, "initial") != NULL) {
+        bench_synchronize("sync_initial", source, path);
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <bounded-sync.h>
+#include <sync.h>
+#include <external-sort.h>
+#include <messages.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Entries of a tree in path order, with their properties
+typedef struct {
+    external_sorter_t sorter; // Paths of the tree (@see make_sorted_list)
+    files_list_entry_t *window; // Entries being analyzed, in path order (ring buffer)
+    bool *is_ready; // Tells for each entry of the window if it was analyzed
+    bool *is_unreadable; // Tells for each analyzed entry of the window if it must be skipped (e.g. removed since listed)
+    int window_size;
+    int first;
+    int count;
+    int analyzers_id; // MQ topic of the analyzers of the tree, 0 when the main process analyzes the entries
+} entry_stream_t;
+
+/*!
+ * @brief open_stream lists a tree into a sorter, and prepares the analysis of its entries
+ * With analyzers, two entries per analyzer are kept in flight, so that they don't wait while the oldest entry is used.
+ * @param stream is a pointer to the stream
+ * @param root is the path of the tree
+ * @param temporary_dir is the directory of the temporary files of the sorter
+ * @param memory_limit is the memory budget of the sorter
+ * @param analyzers_id is the MQ topic of the analyzers of the tree, 0 to analyze the entries in the main process
+ * @param analyzers_count is the number of analyzers of the tree
+ * @return 0 in case of success, -1 else
+ */
+static int open_stream(entry_stream_t *stream, char *root, char *temporary_dir, size_t memory_limit, int analyzers_id, int analyzers_count) {
+    memset(stream, 0, sizeof(entry_stream_t));
+    stream->analyzers_id = analyzers_id;
+    stream->window_size = (analyzers_id != 0 && analyzers_count > 0) ? 2 * analyzers_count : 1;
+    stream->window = malloc(stream->window_size * sizeof(files_list_entry_t));
+    stream->is_ready = calloc(stream->window_size, sizeof(bool));
+    stream->is_unreadable = calloc(stream->window_size, sizeof(bool));
+    if (stream->window == NULL || stream->is_ready == NULL || stream->is_unreadable == NULL) {
+        return -1;
+    }
+    if (init_external_sorter(&stream->sorter, memory_limit, temporary_dir) != 0) {
+        return -1;
+    }
+    return make_sorted_list(&stream->sorter, root);
+}
+
+/*!
+ * @brief close_stream frees the memory and the temporary files of a stream
+ * @param stream is a pointer to the stream
+ */
+static void close_stream(entry_stream_t *stream) {
+    clear_external_sorter(&stream->sorter);
+    free(stream->window);
+    free(stream->is_ready);
+    free(stream->is_unreadable);
+}
+
+/*!
+ * @brief receive_analyzed_entry waits for an entry analyzed by an analyzer, and puts it in the window of its stream
+ * @param streams is the array of the source and destination streams
+ * @param msg_queue is the id of the MQ
+ * @return 0 in case of success, -1 else
+ */
+static int receive_analyzed_entry(entry_stream_t *streams, int msg_queue) {
+    any_message_t message;
+    if (receive_message(msg_queue, &message, MSG_TYPE_TO_MAIN) < 0) {
+        perror("msgrcv");
+        return -1;
+    }
+    if (message.list_entry.op_code != COMMAND_CODE_FILE_ENTRY && message.list_entry.op_code != COMMAND_CODE_FILE_UNREADABLE) {
+        return 0;
+    }
+    entry_stream_t *stream = &streams[message.list_entry.reply_to == MSG_TYPE_TO_SOURCE_ANALYZERS ? 0 : 1];
+    for (int i=0; i<stream->count; ++i) {
+        int slot = (stream->first + i) % stream->window_size;
+        if (!stream->is_ready[slot] && strcmp(stream->window[slot].path_and_name, message.list_entry.payload.path_and_name) == 0) {
+            memcpy(&stream->window[slot], &message.list_entry.payload, sizeof(files_list_entry_t));
+            stream->is_ready[slot] = true;
+            stream->is_unreadable[slot] = message.list_entry.op_code == COMMAND_CODE_FILE_UNREADABLE;
+            break;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief stream_peek gives the next entry of a stream, with its properties
+ * The window is filled with the next entries of the sorter first, so that the analyzers work ahead.
+ * Entries that could not be analyzed (removed or unreadable since they were listed) are skipped.
+ * @param streams is the array of the source and destination streams (answers of both can be received)
+ * @param side is the index of the stream in streams (0 for the source, 1 for the destination)
+ * @param msg_queue is the id of the MQ
+ * @return a pointer to the entry, valid until stream_pop is called, NULL at the end of the stream
+ */
+static files_list_entry_t *stream_peek(entry_stream_t *streams, int side, int msg_queue) {
+    entry_stream_t *stream = &streams[side];
+    files_list_entry_t *entry;
+    while (true) {
+        while (stream->count < stream->window_size && (entry = external_sorter_next(&stream->sorter)) != NULL) {
+            int slot = (stream->first + stream->count) % stream->window_size;
+            memcpy(&stream->window[slot], entry, sizeof(files_list_entry_t));
+            stream->is_ready[slot] = false;
+            if (stream->analyzers_id == 0 || send_analyze_stream_file_command(msg_queue, stream->analyzers_id, &stream->window[slot]) != 0) {
+                stream->is_unreadable[slot] = get_file_stats(&stream->window[slot]) != 0;
+                stream->is_ready[slot] = true;
+            }
+            ++stream->count;
+        }
+        if (stream->count == 0) {
+            return NULL;
+        }
+        while (!stream->is_ready[stream->first]) {
+            if (receive_analyzed_entry(streams, msg_queue) != 0) {
+                return NULL;
+            }
+        }
+        if (!stream->is_unreadable[stream->first]) {
+            return &stream->window[stream->first];
+        }
+        // entrée supprimée ou illisible depuis qu'elle a été listée : elle est ignorée, pas vue comme un fichier vide
+        stream->first = (stream->first + 1) % stream->window_size;
+        --stream->count;
+    }
+}
+
+/*!
+ * @brief stream_pop removes the entry given by stream_peek
+ * @param stream is a pointer to the stream
+ */
+static void stream_pop(entry_stream_t *stream) {
+    stream->first = (stream->first + 1) % stream->window_size;
+    --stream->count;
+}
+
+/*!
+ * @brief apply_entry copies a source entry to the destination, and verifies it when requested
+ * @param the_config is a pointer to the configuration
+ * @param source_entry is the entry to copy
+ */
+static void apply_entry(configuration_t *the_config, files_list_entry_t *source_entry) {
+    if (copy_entry_to_destination(source_entry, the_config) == 0 && the_config->is_verifying && source_entry->entry_type == FICHIER && !the_config->is_dry_run) {
+        verify_copy(source_entry, the_config);
+    }
+}
+
+/*!
+ * @brief synchronize_bounded synchronizes the trees within a memory budget (--memory-limit)
+ * Both trees are listed into sorters, which write sorted runs to temporary files when their half of the budget is
+ * reached. The sorted entries are read back by merging the runs, analyzed (by the analyzers in parallel mode) and
+ * compared as they come, and the differences are applied right away: no complete list is kept in memory.
+ * Without the complete lists, renamed files are copied again (no index of the destination contents), and the
+ * differences are not journaled: each copy is still atomic, so an interrupted run is resumed by running it again.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+void synchronize_bounded(configuration_t *the_config, process_context_t *p_context) {
+    entry_stream_t streams[2];
+    bool uses_analyzers = the_config->is_parallel && p_context->message_queue_id != -1;
+    int msg_queue = p_context->message_queue_id;
+    size_t stream_limit = the_config->memory_limit / 2;
+
+    // les fichiers temporaires sont écrits dans la destination, dont l'écriture a été vérifiée
+    int result = open_stream(&streams[0], the_config->source, the_config->destination, stream_limit, uses_analyzers ? MSG_TYPE_TO_SOURCE_ANALYZERS : 0, p_context->source_analyzers_count);
+    if (result == 0) {
+        result = open_stream(&streams[1], the_config->destination, the_config->destination, stream_limit, uses_analyzers ? MSG_TYPE_TO_DESTINATION_ANALYZERS : 0, p_context->destination_analyzers_count);
+    } else {
+        memset(&streams[1], 0, sizeof(entry_stream_t));
+    }
+    if (result != 0) {
+        fprintf(stderr, "Trees could not be listed within the memory limit\n");
+        close_stream(&streams[0]);
+        close_stream(&streams[1]);
+        return;
+    }
+
+    // même parcours que make_differences_list, sur les flux ordonnés
+    files_list_entry_t *source_entry = stream_peek(streams, 0, msg_queue);
+    files_list_entry_t *destination_entry = stream_peek(streams, 1, msg_queue);
+    while (source_entry != NULL || destination_entry != NULL) {
+        int cmp_result;
+        if (source_entry == NULL) {
+            cmp_result = 1;
+        } else if (destination_entry == NULL) {
+            cmp_result = -1;
+        } else {
+            cmp_result = strcmp(relative_path(source_entry->path_and_name, the_config->source), relative_path(destination_entry->path_and_name, the_config->destination));
+        }
+
+        if (cmp_result <= 0 && (cmp_result < 0 || mismatch(source_entry, destination_entry, the_config->uses_md5))) {
+            apply_entry(the_config, source_entry);
+        }
+        if (cmp_result <= 0) {
+            stream_pop(&streams[0]);
+            source_entry = stream_peek(streams, 0, msg_queue);
+        }
+        if (cmp_result >= 0) {
+            stream_pop(&streams[1]);
+            destination_entry = stream_peek(streams, 1, msg_queue);
+        }
+    }
+
+    close_stream(&streams[0]);
+    close_stream(&streams[1]);
+    if (the_config->uses_quick_hash && !the_config->is_dry_run) {
+        save_quick_hash_runs(the_config);
+    }
+}
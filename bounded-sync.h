@@ -0,0 +1,6 @@
+#pragma once
+
+#include <configuration.h>
+#include <processes.h>
+
+void synchronize_bounded(configuration_t *the_config, process_context_t *p_context);
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE // sync_file_range
+#include <cache-policy.h>
+#include <fcntl.h>
+
+// Set by prepare before the processes are created, so that they all share it
+static bool cache_friendly = false;
+
+/*!
+ * @brief set_cache_friendly enables or disables the cache friendly mode (--cache-friendly)
+ * @param enabled is true to drop the pages of the synchronized files from the page cache
+ */
+void set_cache_friendly(bool enabled) {
+    cache_friendly = enabled;
+}
+
+/*!
+ * @brief is_cache_friendly tells if the cache friendly mode is enabled
+ * @return true if it is enabled, false else
+ */
+bool is_cache_friendly(void) {
+    return cache_friendly;
+}
+
+/*!
+ * @brief cache_window_open starts tracking the pages of a file read or written sequentially
+ * Read files are announced as sequential, so that the kernel reads ahead more.
+ * Nothing is done when the cache friendly mode is disabled.
+ * @param window is a pointer to the window to initialize
+ * @param fd is the file descriptor of the file
+ * @param is_written is true if the file is written, false if it is read
+ */
+void cache_window_open(cache_window_t *window, int fd, bool is_written) {
+    window->fd = fd;
+    window->is_written = is_written;
+    window->released = 0;
+    window->flushed = 0;
+    if (cache_friendly && !is_written) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+}
+
+/*!
+ * @brief cache_window_advance tells how far the file was read or written, and drops the pages behind the window
+ * For written files, the write back of the new pages is started without waiting for it: only pages that are a
+ * full window behind are waited for, they are usually already written back.
+ * @param window is a pointer to the window of the file
+ * @param position is the offset up to which the file was read or written
+ */
+void cache_window_advance(cache_window_t *window, off_t position) {
+    if (!cache_friendly) {
+        return;
+    }
+    if (window->is_written && position > window->flushed) {
+        sync_file_range(window->fd, window->flushed, position - window->flushed, SYNC_FILE_RANGE_WRITE);
+        window->flushed = position;
+    }
+    if (position - window->released < 2 * CACHE_WINDOW_SIZE) {
+        return;
+    }
+    off_t end = position - CACHE_WINDOW_SIZE;
+    if (window->is_written) {
+        sync_file_range(window->fd, window->released, end - window->released, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    posix_fadvise(window->fd, window->released, end - window->released, POSIX_FADV_DONTNEED);
+    window->released = end;
+}
+
+/*!
+ * @brief cache_window_close drops the remaining pages of the file, after their write back for a written file
+ * It must be called before the file descriptor is closed.
+ * @param window is a pointer to the window of the file
+ */
+void cache_window_close(cache_window_t *window) {
+    if (!cache_friendly) {
+        return;
+    }
+    if (window->is_written) {
+        sync_file_range(window->fd, window->released, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    posix_fadvise(window->fd, window->released, 0, POSIX_FADV_DONTNEED);
+}
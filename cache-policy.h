@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// In cache friendly mode, pages of the files read or written are dropped from the page cache once they are this far
+// behind the current position, so that a synchronization doesn't evict the cache of the other programs
+#define CACHE_WINDOW_SIZE (8 << 20)
+
+typedef struct {
+    int fd;
+    bool is_written; // Written pages must be written back before they can be dropped
+    off_t released; // Pages before this offset were dropped
+    off_t flushed; // Write back was started for the pages before this offset
+} cache_window_t;
+
+void set_cache_friendly(bool enabled);
+bool is_cache_friendly(void);
+void cache_window_open(cache_window_t *window, int fd, bool is_written);
+void cache_window_advance(cache_window_t *window, off_t position);
+void cache_window_close(cache_window_t *window);
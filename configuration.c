@@ -6,6 +6,9 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <throttle.h>
+#include <defines.h>
 
 typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
 
@@ -17,12 +20,36 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
  */
 void display_help(char *my_name) {
     printf("%s [options] source_dir destination_dir\n", my_name);
-    printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
+    printf("Options: \t-n <processes count>\tnumber of processes for file calculations (1 to 255, or auto)\n");
     printf("         \t-h display help (this text)\n");
     printf("         \t--date_size_only disables MD5 calculation for files\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
     printf("         \t--dry-run lists the changes that would need to be synchronized but doesn't perform them\n");
     printf("         \t-v enables verbose mode\n");
+    printf("         \t--dedup copies identical new files once and clones or links the others (needs MD5)\n");
+    printf("         \t--journal-batch <count> number of copies made durable together in the journal (default 256)\n");
+    printf("         \t--plan-out <file> saves the changes to synchronize into file instead of performing them\n");
+    printf("         \t--apply <file> performs the changes saved by --plan-out instead of comparing the directories\n");
+    printf("         \t--watch keeps synchronizing the changes of the source after the synchronization, until interrupted\n");
+    printf("         \t--stats=json prints the counters and timings of the run as JSON when it ends\n");
+    printf("         \t--cache-friendly drops the files read and written from the page cache, to spare the other programs\n");
+    printf("         \t--read-limit <rate> maximum bytes read per second, shared by all the processes (K, M or G suffix)\n");
+    printf("         \t--write-limit <rate> maximum bytes written per second\n");
+    printf("         \t--files-limit <rate> maximum files hashed or copied per second\n");
+    printf("         \t--limits-file <file> reads the limits from file (read=, write=, files= lines), reloaded on SIGHUP\n");
+    printf("         \t--exclude <pattern> doesn't synchronize the entries matching pattern (and the content of directories)\n");
+    printf("         \t--include <pattern> synchronizes the entries matching pattern, even if a later rule excludes them\n");
+    printf("         \t--filter-file <file> reads rules from file (\"- pattern\" excludes, \"+ pattern\" includes)\n");
+    printf("         \t                    the first matching rule wins, a pattern ending with / only matches directories\n");
+    printf("         \t--verify reads the copied files again from the destination and copies again those that don't match\n");
+    printf("         \t--memory-limit <size> keeps the memory used by the lists under size (K, M or G suffix), using\n");
+    printf("         \t                     temporary files in the destination; renames are copied and nothing is journaled\n");
+    printf("         \t--dir-cache keeps the listings and MD5 sums of the unchanged directories and files for the next run\n");
+    printf("         \t--full-scan-every <runs> reads and hashes everything again every runs runs with --dir-cache or --quick-hash (default 10)\n");
+    printf("         \t--io-order <order> reads the files to hash or copy in path (default), inode or extent order; inode and\n");
+    printf("         \t                  extent (physical position of the data) avoid the seeks of rotational disks\n");
+    printf("         \t--quick-hash compares fingerprints of sampled blocks instead of the MD5 sums of the whole files;\n");
+    printf("         \t              every --full-scan-every runs (the full scans with --dir-cache), the MD5 sums are computed\n");
 }
 
 /*!
@@ -31,10 +58,29 @@ void display_help(char *my_name) {
  */
 void init_configuration(configuration_t *the_config) {
     the_config -> processes_count = 2;
+    the_config -> is_auto_tuned = false;
     the_config -> is_parallel = true;
     the_config -> is_dry_run = false;
     the_config -> is_verbose = false;
     the_config -> uses_md5 = true;
+    the_config -> uses_dedup = false;
+    the_config -> journal_batch_size = 256;
+    the_config -> plan_output_path[0] = '\0';
+    the_config -> plan_input_path[0] = '\0';
+    the_config -> is_watching = false;
+    the_config -> prints_stats = false;
+    the_config -> is_cache_friendly = false;
+    the_config -> read_limit = 0;
+    the_config -> write_limit = 0;
+    the_config -> files_limit = 0;
+    the_config -> limits_path[0] = '\0';
+    init_filter(&the_config -> filter);
+    the_config -> is_verifying = false;
+    the_config -> memory_limit = 0;
+    the_config -> uses_dir_cache = false;
+    the_config -> full_scan_every = 10;
+    the_config -> io_order = IO_ORDER_PATH;
+    the_config -> uses_quick_hash = false;
 }
 
 /*!
@@ -45,38 +91,207 @@ void init_configuration(configuration_t *the_config) {
  * @return -1 if configuration cannot succeed, 0 when ok
  */
 int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
-    DIR *source = opendir(argv[argc-2]);
-    DIR *destination = opendir(argv[argc-1]);
-    if (access(argv[argc-2], R_OK) && (access(argv[argc-1], W_OK) ||  mkdir(argv[argc-1], 0764))){
-        int opt = 0;
-        struct option my_opts[] = {
-                {.name="date-size-only",.has_arg=0,.flag=0,.val='m'},
-                {.name="no-parallel",.has_arg=0,.flag=0,.val='p'},
-                {.name="dry-run",.has_arg=0,.flag=0,.val='d'},
-                {.name=0,.has_arg=0,.flag=0,.val=0},
-        };
-        while((opt = getopt_long(argc, argv, "vn:", my_opts, NULL)) != -1) {
-            switch (opt) {
-                case 'v':
-                    the_config -> is_verbose = true;
-                    break;
-                case 'n':
-                    the_config -> processes_count = atoi(optarg);
-                    break;
-                case 'm':
-                    the_config -> uses_md5 = false;
-                    break;
-                case 'p':
-                    the_config -> is_parallel = false;
-                    break;
-                case 'd':
-                    the_config -> is_dry_run = true;
+    int opt = 0;
+    struct option my_opts[] = {
+            {.name="date-size-only",.has_arg=0,.flag=0,.val='m'},
+            {.name="no-parallel",.has_arg=0,.flag=0,.val='p'},
+            {.name="dry-run",.has_arg=0,.flag=0,.val='d'},
+            {.name="dedup",.has_arg=0,.flag=0,.val='D'},
+            {.name="journal-batch",.has_arg=1,.flag=0,.val='j'},
+            {.name="plan-out",.has_arg=1,.flag=0,.val='o'},
+            {.name="apply",.has_arg=1,.flag=0,.val='a'},
+            {.name="watch",.has_arg=0,.flag=0,.val='w'},
+            {.name="stats",.has_arg=1,.flag=0,.val='s'},
+            {.name="cache-friendly",.has_arg=0,.flag=0,.val='c'},
+            {.name="read-limit",.has_arg=1,.flag=0,.val='R'},
+            {.name="write-limit",.has_arg=1,.flag=0,.val='W'},
+            {.name="files-limit",.has_arg=1,.flag=0,.val='F'},
+            {.name="limits-file",.has_arg=1,.flag=0,.val='L'},
+            {.name="exclude",.has_arg=1,.flag=0,.val='x'},
+            {.name="include",.has_arg=1,.flag=0,.val='i'},
+            {.name="filter-file",.has_arg=1,.flag=0,.val='f'},
+            {.name="verify",.has_arg=0,.flag=0,.val='V'},
+            {.name="memory-limit",.has_arg=1,.flag=0,.val='M'},
+            {.name="dir-cache",.has_arg=0,.flag=0,.val='C'},
+            {.name="full-scan-every",.has_arg=1,.flag=0,.val='S'},
+            {.name="io-order",.has_arg=1,.flag=0,.val='O'},
+            {.name="quick-hash",.has_arg=0,.flag=0,.val='Q'},
+            {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+    while((opt = getopt_long(argc, argv, "vn:h", my_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'v':
+                the_config -> is_verbose = true;
+                break;
+            case 'n': {
+                // auto : le nombre est choisi selon les processeurs et les disques (@see choose_analyzers_counts)
+                if (strcmp(optarg, "auto") == 0) {
+                    the_config -> is_auto_tuned = true;
                     break;
+                }
+                char *end;
+                long count = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || count < 1 || count > UINT8_MAX) {
+                    fprintf(stderr, "Invalid processes count %s (1 to %d, or auto)\n", optarg, UINT8_MAX);
+                    return -1;
+                }
+                the_config -> processes_count = count;
+                the_config -> is_auto_tuned = false;
+                break;
             }
+            case 'm':
+                the_config -> uses_md5 = false;
+                break;
+            case 'p':
+                the_config -> is_parallel = false;
+                break;
+            case 'd':
+                the_config -> is_dry_run = true;
+                break;
+            case 'D':
+                the_config -> uses_dedup = true;
+                break;
+            case 'j': {
+                char *end;
+                long size = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || size < 1 || size > UINT32_MAX) {
+                    fprintf(stderr, "Invalid journal batch size %s (at least 1)\n", optarg);
+                    return -1;
+                }
+                the_config -> journal_batch_size = size;
+                break;
+            }
+            case 'o':
+            case 'a':
+                if (strlen(optarg) >= sizeof(the_config -> plan_output_path)) {
+                    fprintf(stderr, "Plan path is too long\n");
+                    return -1;
+                }
+                strcpy(opt == 'o' ? the_config -> plan_output_path : the_config -> plan_input_path, optarg);
+                break;
+            case 'w':
+                the_config -> is_watching = true;
+                break;
+            case 's':
+                // JSON est le seul format disponible
+                if (strcmp(optarg, "json") != 0) {
+                    fprintf(stderr, "Unknown statistics format %s\n", optarg);
+                    return -1;
+                }
+                the_config -> prints_stats = true;
+                break;
+            case 'c':
+                the_config -> is_cache_friendly = true;
+                break;
+            case 'R':
+            case 'W':
+            case 'F':
+                if (parse_rate(optarg, opt == 'R' ? &the_config -> read_limit : opt == 'W' ? &the_config -> write_limit : &the_config -> files_limit) != 0) {
+                    fprintf(stderr, "Invalid rate %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'L':
+                if (strlen(optarg) >= sizeof(the_config -> limits_path)) {
+                    fprintf(stderr, "Limits file path is too long\n");
+                    return -1;
+                }
+                strcpy(the_config -> limits_path, optarg);
+                break;
+            case 'x':
+            case 'i':
+                if (add_filter_rule(&the_config -> filter, optarg, opt == 'i') != 0) {
+                    fprintf(stderr, "Invalid pattern %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'f':
+                if (load_filter_file(&the_config -> filter, optarg) != 0) {
+                    return -1;
+                }
+                break;
+            case 'V':
+                the_config -> is_verifying = true;
+                break;
+            case 'M':
+                // mêmes suffixes que les limites de débit
+                if (parse_rate(optarg, &the_config -> memory_limit) != 0 || the_config -> memory_limit < MIN_MEMORY_LIMIT) {
+                    fprintf(stderr, "Invalid memory limit %s (at least %dK)\n", optarg, MIN_MEMORY_LIMIT >> 10);
+                    return -1;
+                }
+                break;
+            case 'C':
+                the_config -> uses_dir_cache = true;
+                break;
+            case 'S': {
+                char *end;
+                long runs = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || runs < 1 || runs > UINT32_MAX) {
+                    fprintf(stderr, "Invalid number of runs %s\n", optarg);
+                    return -1;
+                }
+                the_config -> full_scan_every = runs;
+                break;
+            }
+            case 'O':
+                if (parse_io_order(optarg, &the_config -> io_order) != 0) {
+                    fprintf(stderr, "Invalid I/O order %s (path, inode or extent)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'Q':
+                the_config -> uses_quick_hash = true;
+                break;
+            default:
+                display_help(argv[0]);
+                return -1;
         }
-        return 0;
-    }else{
+    }
+
+    // Source et destination sont les deux derniers paramètres non optionnels
+    if (argc - optind != 2) {
+        display_help(argv[0]);
+        return -1;
+    }
+    if (strlen(argv[optind]) >= sizeof(the_config -> source) || strlen(argv[optind+1]) >= sizeof(the_config -> destination)) {
+        fprintf(stderr, "Source or destination path is too long\n");
+        return -1;
+    }
+    strcpy(the_config -> source, argv[optind]);
+    strcpy(the_config -> destination, argv[optind+1]);
+    if (the_config -> plan_output_path[0] != '\0' && the_config -> plan_input_path[0] != '\0') {
+        fprintf(stderr, "--plan-out and --apply cannot be used together\n");
+        return -1;
+    }
+    if (the_config -> is_verifying && !the_config -> uses_md5) {
+        fprintf(stderr, "--verify needs the MD5 sums of the source, it cannot be used with --date-size-only\n");
+        return -1;
+    }
+    if (the_config -> uses_dedup && !the_config -> uses_md5) {
+        fprintf(stderr, "--dedup finds identical files by their MD5 sums, it cannot be used with --date-size-only\n");
+        return -1;
+    }
+    if (the_config -> uses_quick_hash && !the_config -> uses_md5) {
+        fprintf(stderr, "--quick-hash cannot be used with --date-size-only, which computes no digest\n");
+        return -1;
+    }
+    if (the_config -> memory_limit > 0 && (the_config -> uses_dedup || the_config -> is_watching || the_config -> plan_output_path[0] != '\0' || the_config -> plan_input_path[0] != '\0')) {
+        fprintf(stderr, "--memory-limit cannot be used with --dedup, --watch, --plan-out or --apply, which keep complete lists\n");
+        return -1;
+    }
+    if (the_config -> uses_dir_cache && the_config -> memory_limit > 0) {
+        fprintf(stderr, "--dir-cache cannot be used with --memory-limit, the cache holds every entry\n");
+        return -1;
+    }
+    if (the_config -> is_watching && (the_config -> plan_output_path[0] != '\0' || the_config -> plan_input_path[0] != '\0')) {
+        fprintf(stderr, "--watch cannot be used with --plan-out or --apply\n");
+        return -1;
+    }
+
+    // La source doit être lisible, la destination doit être écrivable ou pouvoir être créée
+    if (access(the_config -> source, R_OK) != 0 || (access(the_config -> destination, W_OK) != 0 && mkdir(the_config -> destination, 0764) != 0)) {
         display_help(argv[0]);
         return -1;
     }
+    return 0;
 }
@@ -2,15 +2,36 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <filter.h>
+#include <io-order.h>
 
 typedef struct {
     char source[1024];
     char destination[1024];
     uint8_t processes_count;
+    bool is_auto_tuned;
     bool is_parallel;
     bool uses_md5;
     bool is_verbose;
     bool is_dry_run;
+    bool uses_dedup;
+    uint32_t journal_batch_size;
+    char plan_output_path[1024];
+    char plan_input_path[1024];
+    bool is_watching;
+    bool prints_stats;
+    bool is_cache_friendly;
+    uint64_t read_limit;
+    uint64_t write_limit;
+    uint64_t files_limit;
+    char limits_path[1024];
+    filter_t filter;
+    bool is_verifying;
+    uint64_t memory_limit;
+    bool uses_dir_cache;
+    uint32_t full_scan_every;
+    io_order_t io_order;
+    bool uses_quick_hash;
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
@@ -1,3 +1,23 @@
 #pragma once
 
-#define PATH_SIZE 4096
\ No newline at end of file
+#define PATH_SIZE 4096
+
+// Names of the files the program creates in the destination start with this prefix, they are never listed
+#define STATE_FILES_PREFIX ".lp25-backup"
+#define TEMPORARY_FILE_PREFIX STATE_FILES_PREFIX ".tmp."
+#define JOURNAL_FILE_NAME STATE_FILES_PREFIX ".journal"
+#define DIR_CACHE_FILE_NAME STATE_FILES_PREFIX ".dircache"
+#define QUICK_HASH_RUNS_FILE_NAME STATE_FILES_PREFIX ".quickhash"
+
+// Maximum size copied by each sendfile call
+#define COPY_CHUNK_SIZE (1 << 20)
+
+// Alignment of the buffers of the reads bypassing the page cache (O_DIRECT)
+#define DIRECT_IO_ALIGNMENT 4096
+
+// Sampled blocks of the quick fingerprint (--quick-hash): the head, the tail and evenly spaced blocks in between
+#define QUICK_HASH_BLOCK_SIZE (64 << 10)
+#define QUICK_HASH_STRIDE_BLOCKS 8
+
+// Smallest memory budget of the lists (--memory-limit): a few entries and merged runs
+#define MIN_MEMORY_LIMIT (1 << 20)
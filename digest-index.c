@@ -0,0 +1,206 @@
+#include <digest-index.h>
+#include <file-properties.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief content_key gives the digest identifying the content of an entry
+ * @param entry is the entry
+ * @return its MD5 sum, or its quick fingerprint when the MD5 sums are not computed (--quick-hash)
+ */
+static uint8_t *content_key(files_list_entry_t *entry) {
+    return ((get_digests() & DIGEST_MD5) != 0) ? entry->md5sum : entry->fingerprint;
+}
+
+/*!
+ * @brief digest_hash computes the bucket of an entry from its size and digest (@see content_key)
+ * The digest is already uniformly distributed, so its first bytes are mixed with the size.
+ * @param entry is the entry to hash
+ * @param buckets_count is the number of buckets of the index
+ * @return the bucket number
+ */
+static size_t digest_hash(files_list_entry_t *entry, size_t buckets_count) {
+    uint64_t hash;
+    memcpy(&hash, content_key(entry), sizeof(hash));
+    hash ^= entry->size * 0x9E3779B97F4A7C15ULL;
+    return hash % buckets_count;
+}
+
+/*!
+ * @brief same_digest tests if two entries have the same content key (size and digest)
+ * @param lhd is the first entry
+ * @param rhd is the second entry
+ * @return true if both keys are equal, false else
+ */
+static bool same_digest(files_list_entry_t *lhd, files_list_entry_t *rhd) {
+    return lhd->size == rhd->size && memcmp(content_key(lhd), content_key(rhd), sizeof(lhd->md5sum)) == 0;
+}
+
+/*!
+ * @brief init_digest_index initializes an empty digest index
+ * @param index is a pointer to the index to initialize
+ * @param expected_count is the number of entries expected (initial size of the buckets array), 0 if unknown
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int init_digest_index(digest_index_t *index, size_t expected_count) {
+    if (index == NULL) {
+        return -1;
+    }
+    index->count = 0;
+    index->buckets_count = expected_count < 16 ? 16 : expected_count;
+    index->buckets = calloc(index->buckets_count, sizeof(digest_index_node_t *));
+    if (index->buckets == NULL) {
+        index->buckets_count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief grow_digest_index doubles the number of buckets of an index and moves its nodes to their new buckets
+ * The nodes are kept, so the pointers to them stay valid, but their order in the buckets changes.
+ * @param index is a pointer to the index
+ * @return 0 in case of success, -1 else (out of memory, the index is unchanged)
+ */
+static int grow_digest_index(digest_index_t *index) {
+    size_t buckets_count = index->buckets_count * 2;
+    digest_index_node_t **buckets = calloc(buckets_count, sizeof(digest_index_node_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+    for (size_t i=0; i<index->buckets_count; ++i) {
+        while (index->buckets[i]) {
+            digest_index_node_t *node = index->buckets[i];
+            index->buckets[i] = node->next;
+            size_t bucket = digest_hash(node->entry, buckets_count);
+            node->next = buckets[bucket];
+            buckets[bucket] = node;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->buckets_count = buckets_count;
+    return 0;
+}
+
+/*!
+ * @brief clear_digest_index frees the memory used by an index
+ * The indexed entries are not freed, they still belong to their list.
+ * @param index is a pointer to the index to clear
+ */
+void clear_digest_index(digest_index_t *index) {
+    if (index == NULL || index->buckets == NULL) {
+        return;
+    }
+    for (size_t i=0; i<index->buckets_count; ++i) {
+        while (index->buckets[i]) {
+            digest_index_node_t *tmp = index->buckets[i];
+            index->buckets[i] = tmp->next;
+            free(tmp->destination_path);
+            free(tmp);
+        }
+    }
+    free(index->buckets);
+    index->buckets = NULL;
+    index->buckets_count = 0;
+    index->count = 0;
+}
+
+/*!
+ * @brief add_to_digest_index adds a file entry to the index
+ * Only files are indexed, directories are ignored. The buckets array grows when there are more entries than buckets,
+ * so an index can be initialized without knowing its size. It must not be called while iterating over matches
+ * (@see find_in_digest_index), since growing changes the order of the nodes.
+ * @param index is a pointer to the index
+ * @param entry is the entry to add. It is not copied: it must live longer than the index
+ * @param is_orphan tells if the entry has no counterpart in the source tree (it can then be renamed)
+ * @return a pointer to the new node, NULL if the entry was not added
+ */
+digest_index_node_t *add_to_digest_index(digest_index_t *index, files_list_entry_t *entry, bool is_orphan) {
+    if (index == NULL || index->buckets == NULL || entry == NULL || entry->entry_type != FICHIER) {
+        return NULL;
+    }
+    // the lookups stay short as long as there is about one entry per bucket
+    if (index->count >= index->buckets_count) {
+        grow_digest_index(index);
+    }
+    digest_index_node_t *node = malloc(sizeof(digest_index_node_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    size_t bucket = digest_hash(entry, index->buckets_count);
+    node->entry = entry;
+    node->destination_path = NULL;
+    node->is_orphan = is_orphan;
+    node->next = index->buckets[bucket];
+    index->buckets[bucket] = node;
+    ++index->count;
+    return node;
+}
+
+/*!
+ * @brief find_in_digest_index looks up for indexed entries with the same size and md5sum as entry
+ * @param index is a pointer to the index
+ * @param entry is the entry whose content to look for
+ * @param after is the last node returned by a previous call to iterate over all the matches, NULL to get the first one
+ * @return a pointer to the matching node, NULL if there is none (left)
+ */
+digest_index_node_t *find_in_digest_index(digest_index_t *index, files_list_entry_t *entry, digest_index_node_t *after) {
+    if (index == NULL || index->buckets == NULL || entry == NULL) {
+        return NULL;
+    }
+    digest_index_node_t *cursor = (after == NULL) ? index->buckets[digest_hash(entry, index->buckets_count)] : after->next;
+    for (; cursor != NULL; cursor = cursor->next) {
+        if (same_digest(cursor->entry, entry)) {
+            return cursor;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief find_entry_in_digest_index looks up for the node of an indexed entry
+ * @param index is a pointer to the index
+ * @param entry is the indexed entry, with the size and digest it had when it was added
+ * @return a pointer to its node, NULL if the entry is not indexed
+ */
+digest_index_node_t *find_entry_in_digest_index(digest_index_t *index, files_list_entry_t *entry) {
+    for (digest_index_node_t *node = find_in_digest_index(index, entry, NULL); node != NULL; node = find_in_digest_index(index, entry, node)) {
+        if (node->entry == entry) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief remove_from_digest_index removes an entry from the index
+ * It must be called before the size or digest of the entry change, since they locate its node.
+ * @param index is a pointer to the index
+ * @param entry is the entry to remove
+ */
+void remove_from_digest_index(digest_index_t *index, files_list_entry_t *entry) {
+    if (index == NULL || index->buckets == NULL || entry == NULL) {
+        return;
+    }
+    digest_index_node_t **link = &index->buckets[digest_hash(entry, index->buckets_count)];
+    for (; *link != NULL; link = &(*link)->next) {
+        if ((*link)->entry == entry) {
+            digest_index_node_t *tmp = *link;
+            *link = tmp->next;
+            free(tmp->destination_path);
+            free(tmp);
+            --index->count;
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief digest_index_node_path gives the current path of an indexed file
+ * @param node is the node
+ * @return the path where the content currently is (it changes when the file was renamed)
+ */
+char *digest_index_node_path(digest_index_node_t *node) {
+    return (node->destination_path != NULL) ? node->destination_path : node->entry->path_and_name;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <files-list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct _digest_index_node {
+    files_list_entry_t *entry;
+    char *destination_path; // Where the content is in the destination when it is not the entry path (renamed or copied entry), NULL else
+    bool is_orphan; // True when the entry has no counterpart in the source tree
+    struct _digest_index_node *next;
+} digest_index_node_t;
+
+typedef struct {
+    digest_index_node_t **buckets;
+    size_t buckets_count;
+    size_t count;
+} digest_index_t;
+
+int init_digest_index(digest_index_t *index, size_t expected_count);
+void clear_digest_index(digest_index_t *index);
+digest_index_node_t *add_to_digest_index(digest_index_t *index, files_list_entry_t *entry, bool is_orphan);
+digest_index_node_t *find_in_digest_index(digest_index_t *index, files_list_entry_t *entry, digest_index_node_t *after);
+digest_index_node_t *find_entry_in_digest_index(digest_index_t *index, files_list_entry_t *entry);
+void remove_from_digest_index(digest_index_t *index, files_list_entry_t *entry);
+char *digest_index_node_path(digest_index_node_t *node);
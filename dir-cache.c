@@ -0,0 +1,483 @@
+#include <dir-cache.h>
+#include <utility.h>
+#include <defines.h>
+#include <stats.h>
+#include <filter.h>
+#include <file-properties.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The cache is a header (magic, source and destination paths, filter fingerprint, runs since the last full scan,
+// records count) followed by the records. It is loaded before the processes are created, which share it read only.
+#define DIR_CACHE_MAGIC "LP25DCH2"
+// Entries changed less than this before the listing started are not recorded: their timestamps may come from a
+// coarse clock, and they could change again without their timestamps moving
+#define DIR_CACHE_MARGIN_NS 1000000000LL
+
+static dir_cache_t current_cache;
+
+/*!
+ * @brief dir_cache_path builds the path of the cache, in the destination directory
+ * @param result is the buffer receiving the path (PATH_SIZE long)
+ * @param the_config is a pointer to the configuration
+ * @return a pointer to result, NULL in case of error
+ */
+static char *dir_cache_path(char *result, configuration_t *the_config) {
+    return concat_path(result, the_config->destination, DIR_CACHE_FILE_NAME);
+}
+
+/*!
+ * @brief record_hash computes the FNV-1a hash of a path
+ * @param path is the path to hash
+ * @return the hash value
+ */
+static size_t record_hash(const char *path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *path != '\0'; ++path) {
+        hash = (hash ^ (uint8_t) *path) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief init_cache initializes an empty cache
+ * @param cache is a pointer to the cache
+ * @param expected_count is the expected number of records, to size the hash table
+ * @return 0 in case of success, -1 else
+ */
+static int init_cache(dir_cache_t *cache, size_t expected_count) {
+    memset(cache, 0, sizeof(dir_cache_t));
+    cache->buckets_count = (expected_count > 512) ? expected_count : 512;
+    cache->buckets = calloc(cache->buckets_count, sizeof(dir_cache_record_t *));
+    return (cache->buckets == NULL) ? -1 : 0;
+}
+
+/*!
+ * @brief free_cache frees the records of a cache
+ * @param cache is a pointer to the cache
+ */
+static void free_cache(dir_cache_t *cache) {
+    for (size_t i=0; cache->buckets != NULL && i<cache->buckets_count; ++i) {
+        dir_cache_record_t *cursor = cache->buckets[i];
+        while (cursor != NULL) {
+            dir_cache_record_t *next = cursor->next;
+            free(cursor->path);
+            free(cursor->children);
+            free(cursor);
+            cursor = next;
+        }
+    }
+    free(cache->buckets);
+    memset(cache, 0, sizeof(dir_cache_t));
+}
+
+/*!
+ * @brief find_record finds the record of a path
+ * @param cache is a pointer to the cache
+ * @param path is the path of the entry
+ * @return a pointer to the record, NULL if there is none
+ */
+static dir_cache_record_t *find_record(dir_cache_t *cache, const char *path) {
+    if (cache->buckets == NULL) {
+        return NULL;
+    }
+    for (dir_cache_record_t *cursor = cache->buckets[record_hash(path) % cache->buckets_count]; cursor != NULL; cursor = cursor->next) {
+        if (strcmp(cursor->path, path) == 0) {
+            return cursor;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief add_record adds a record to a cache, which takes ownership of it
+ * @param cache is a pointer to the cache
+ * @param record is a pointer to the allocated record
+ */
+static void add_record(dir_cache_t *cache, dir_cache_record_t *record) {
+    size_t bucket = record_hash(record->path) % cache->buckets_count;
+    record->next = cache->buckets[bucket];
+    cache->buckets[bucket] = record;
+    ++cache->count;
+}
+
+/*!
+ * @brief same_time compares two timestamps
+ * @param lhd is the first timestamp
+ * @param rhd is the second timestamp
+ * @return true if they are equal
+ */
+static bool same_time(struct timespec lhd, struct timespec rhd) {
+    return lhd.tv_sec == rhd.tv_sec && lhd.tv_nsec == rhd.tv_nsec;
+}
+
+/*!
+ * @brief is_unchanged tells if an entry still has the inode and timestamps of its record
+ * The ctime changes with any change of the inode (content, mode, rename), and it can't be set by the programs.
+ * @param record is a pointer to the record
+ * @param entry_stat is a pointer to the current stat of the entry
+ * @return true if the entry is unchanged
+ */
+static bool is_unchanged(dir_cache_record_t *record, struct stat *entry_stat) {
+    return record->inode == entry_stat->st_ino && same_time(record->mtime, entry_stat->st_mtim) && same_time(record->ctime, entry_stat->st_ctim);
+}
+
+/*!
+ * @brief read_record reads a record written by write_record
+ * @param stream is the stream to read from
+ * @return a pointer to the allocated record, NULL at the end of the stream or in case of error
+ */
+static dir_cache_record_t *read_record(FILE *stream) {
+    char path[PATH_SIZE];
+    uint8_t entry_type;
+    int64_t times[4];
+    dir_cache_record_t *record = calloc(1, sizeof(dir_cache_record_t));
+    if (record == NULL) {
+        return NULL;
+    }
+    if (read_string(stream, path, sizeof(path)) != 0
+        || fread(&entry_type, sizeof(entry_type), 1, stream) != 1
+        || fread(&record->inode, sizeof(record->inode), 1, stream) != 1
+        || fread(times, sizeof(times), 1, stream) != 1
+        || fread(&record->size, sizeof(record->size), 1, stream) != 1
+        || fread(record->md5sum, sizeof(record->md5sum), 1, stream) != 1
+        || fread(record->fingerprint, sizeof(record->fingerprint), 1, stream) != 1
+        || fread(&record->digests, sizeof(record->digests), 1, stream) != 1
+        || fread(&record->entries_count, sizeof(record->entries_count), 1, stream) != 1
+        || fread(&record->children_size, sizeof(record->children_size), 1, stream) != 1
+        || (record->path = strdup(path)) == NULL) {
+        free(record);
+        return NULL;
+    }
+    record->entry_type = (entry_type == DOSSIER) ? DOSSIER : FICHIER;
+    record->mtime = (struct timespec) {.tv_sec = times[0], .tv_nsec = times[1]};
+    record->ctime = (struct timespec) {.tv_sec = times[2], .tv_nsec = times[3]};
+    if (record->children_size > 0) {
+        record->children = malloc(record->children_size);
+        if (record->children == NULL || fread(record->children, 1, record->children_size, stream) != record->children_size
+            || record->children[record->children_size - 1] != '\0') {
+            free(record->children);
+            free(record->path);
+            free(record);
+            return NULL;
+        }
+    }
+    return record;
+}
+
+/*!
+ * @brief write_record writes a record
+ * @param stream is the stream to write into
+ * @param record is a pointer to the record
+ * @return 0 in case of success, -1 else
+ */
+static int write_record(FILE *stream, dir_cache_record_t *record) {
+    uint8_t entry_type = record->entry_type;
+    int64_t times[4] = {record->mtime.tv_sec, record->mtime.tv_nsec, record->ctime.tv_sec, record->ctime.tv_nsec};
+    if (write_string(stream, record->path) != 0
+        || fwrite(&entry_type, sizeof(entry_type), 1, stream) != 1
+        || fwrite(&record->inode, sizeof(record->inode), 1, stream) != 1
+        || fwrite(times, sizeof(times), 1, stream) != 1
+        || fwrite(&record->size, sizeof(record->size), 1, stream) != 1
+        || fwrite(record->md5sum, sizeof(record->md5sum), 1, stream) != 1
+        || fwrite(record->fingerprint, sizeof(record->fingerprint), 1, stream) != 1
+        || fwrite(&record->digests, sizeof(record->digests), 1, stream) != 1
+        || fwrite(&record->entries_count, sizeof(record->entries_count), 1, stream) != 1
+        || fwrite(&record->children_size, sizeof(record->children_size), 1, stream) != 1
+        || (record->children_size > 0 && fwrite(record->children, 1, record->children_size, stream) != record->children_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief load_dir_cache loads the records of the previous synchronization (--dir-cache)
+ * Every full_scan_every runs, or when the filters changed, the run is a full scan: directories are read and files
+ * hashed again, and the records are only compared with what is found (@see check_cached_digest).
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success (including when there is no cache yet), -1 else
+ */
+int load_dir_cache(configuration_t *the_config) {
+    char path[PATH_SIZE];
+    free_cache(&current_cache);
+    if (dir_cache_path(path, the_config) == NULL || init_cache(&current_cache, 0) != 0) {
+        return -1;
+    }
+    current_cache.is_full_scan = true;
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return 0;
+    }
+
+    char magic[sizeof(DIR_CACHE_MAGIC)] = {0};
+    char source[sizeof(the_config->source)];
+    char destination[sizeof(the_config->destination)];
+    uint64_t fingerprint, count;
+    uint32_t runs_since_full_scan;
+    if (fread(magic, 1, strlen(DIR_CACHE_MAGIC), stream) != strlen(DIR_CACHE_MAGIC) || strcmp(magic, DIR_CACHE_MAGIC) != 0
+        || read_string(stream, source, sizeof(source)) != 0 || read_string(stream, destination, sizeof(destination)) != 0
+        || fread(&fingerprint, sizeof(fingerprint), 1, stream) != 1 || fread(&runs_since_full_scan, sizeof(runs_since_full_scan), 1, stream) != 1
+        || fread(&count, sizeof(count), 1, stream) != 1) {
+        fclose(stream);
+        return 0;
+    }
+    // Cache of other trees, or listed with other filters: it will be replaced after a full scan
+    if (strcmp(source, the_config->source) != 0 || strcmp(destination, the_config->destination) != 0 || fingerprint != filter_fingerprint(&the_config->filter)) {
+        fclose(stream);
+        return 0;
+    }
+
+    free_cache(&current_cache);
+    if (init_cache(&current_cache, count) != 0) {
+        fclose(stream);
+        return -1;
+    }
+    for (uint64_t i=0; i<count; ++i) {
+        dir_cache_record_t *record = read_record(stream);
+        if (record == NULL) {
+            // A truncated cache is only partly used
+            break;
+        }
+        add_record(&current_cache, record);
+    }
+    fclose(stream);
+    current_cache.runs_since_full_scan = runs_since_full_scan;
+    current_cache.is_full_scan = the_config->full_scan_every <= 1 || runs_since_full_scan + 1 >= the_config->full_scan_every;
+    if (the_config->is_verbose) {
+        printf("Directory cache: %lu records%s\n", (unsigned long) current_cache.count, current_cache.is_full_scan ? ", full scan" : "");
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_dir_cache frees the loaded records
+ */
+void clear_dir_cache(void) {
+    free_cache(&current_cache);
+}
+
+/*!
+ * @brief is_dir_cache_full_scan tells if the run is a full scan (@see load_dir_cache)
+ * @return true if the records are not used, false else or if the cache was not loaded
+ */
+bool is_dir_cache_full_scan(void) {
+    return current_cache.buckets != NULL && current_cache.is_full_scan;
+}
+
+/*!
+ * @brief find_cached_directory finds the listing of a directory that didn't change since the previous synchronization
+ * Creating, removing or renaming an entry changes the mtime of its directory, so an unchanged directory still has
+ * the child entries it had.
+ * @param path is the path of the directory
+ * @param dir_stat is a pointer to the current stat of the directory
+ * @return a pointer to the record of the directory, NULL if it must be read
+ */
+dir_cache_record_t *find_cached_directory(char *path, struct stat *dir_stat) {
+    if (current_cache.is_full_scan) {
+        return NULL;
+    }
+    dir_cache_record_t *record = find_record(&current_cache, path);
+    if (record == NULL || record->entry_type != DOSSIER || !is_unchanged(record, dir_stat)) {
+        return NULL;
+    }
+    stats_add(STAT_DIRS_REUSED, 1);
+    return record;
+}
+
+/*!
+ * @brief reuse_cached_digest gets the digests of a file from its record if the file is unchanged
+ * The record must know the digests computed during this run (@see set_digests).
+ * @param entry is the entry of the file, receiving the MD5 sum and the fingerprint
+ * @param file_stat is a pointer to the current stat of the file
+ * @return true if the MD5 sum was reused, false if it must be computed
+ */
+bool reuse_cached_digest(files_list_entry_t *entry, struct stat *file_stat) {
+    if (current_cache.is_full_scan) {
+        return false;
+    }
+    dir_cache_record_t *record = find_record(&current_cache, entry->path_and_name);
+    if (record == NULL || record->entry_type != FICHIER || record->size != (uint64_t) file_stat->st_size || !is_unchanged(record, file_stat)
+        || (record->digests & get_digests()) != get_digests()) {
+        return false;
+    }
+    memcpy(entry->md5sum, record->md5sum, sizeof(entry->md5sum));
+    memcpy(entry->fingerprint, record->fingerprint, sizeof(entry->fingerprint));
+    stats_add(STAT_DIGESTS_REUSED, 1);
+    return true;
+}
+
+/*!
+ * @brief check_cached_digest compares the computed digests of a file with its record, during a full scan
+ * A record that would have been reused with other digests means that a change was missed since the previous full
+ * scan: it is reported, and replaced when the cache is saved.
+ * @param entry is the entry of the file, with its computed digests
+ * @param file_stat is a pointer to the current stat of the file
+ */
+void check_cached_digest(files_list_entry_t *entry, struct stat *file_stat) {
+    if (!current_cache.is_full_scan) {
+        return;
+    }
+    dir_cache_record_t *record = find_record(&current_cache, entry->path_and_name);
+    if (record == NULL || record->entry_type != FICHIER || record->size != (uint64_t) file_stat->st_size || !is_unchanged(record, file_stat)) {
+        return;
+    }
+    uint8_t digests = record->digests & get_digests();
+    if (((digests & DIGEST_MD5) != 0 && memcmp(record->md5sum, entry->md5sum, sizeof(entry->md5sum)) != 0)
+        || ((digests & DIGEST_FINGERPRINT) != 0 && memcmp(record->fingerprint, entry->fingerprint, sizeof(entry->fingerprint)) != 0)) {
+        stats_add(STAT_STALE_CACHE_RECORDS, 1);
+        fprintf(stderr, "%s: changed without changing its inode, the directory cache was stale\n", entry->path_and_name);
+    }
+}
+
+/*!
+ * @brief is_settled tells if an entry was last changed early enough before the listing to be recorded
+ * @param entry_stat is a pointer to the stat of the entry
+ * @param listing_start is the time when the listing started
+ * @return true if the entry can be recorded
+ */
+static bool is_settled(struct stat *entry_stat, struct timespec *listing_start) {
+    int64_t limit = (int64_t) listing_start->tv_sec * 1000000000LL + listing_start->tv_nsec - DIR_CACHE_MARGIN_NS;
+    int64_t mtime = (int64_t) entry_stat->st_mtim.tv_sec * 1000000000LL + entry_stat->st_mtim.tv_nsec;
+    int64_t ctime = (int64_t) entry_stat->st_ctim.tv_sec * 1000000000LL + entry_stat->st_ctim.tv_nsec;
+    return mtime < limit && ctime < limit;
+}
+
+/*!
+ * @brief record_entry adds the record of a listed entry to a new cache, if it didn't change since it was listed
+ * @param cache is a pointer to the new cache
+ * @param path is the path of the entry
+ * @param listed_entry is the listed entry, NULL for the roots (directories)
+ * @param listing_start is the time when the listing started
+ */
+static void record_entry(dir_cache_t *cache, char *path, files_list_entry_t *listed_entry, struct timespec *listing_start) {
+    struct stat entry_stat;
+    if (lstat(path, &entry_stat) != 0 || !is_settled(&entry_stat, listing_start)) {
+        return;
+    }
+    bool is_dir = S_ISDIR(entry_stat.st_mode);
+    if (listed_entry != NULL && (is_dir != (listed_entry->entry_type == DOSSIER)
+        || (!is_dir && (listed_entry->size != (uint64_t) entry_stat.st_size || !same_time(listed_entry->mtime, entry_stat.st_mtim))))) {
+        return;
+    }
+    dir_cache_record_t *record = calloc(1, sizeof(dir_cache_record_t));
+    if (record == NULL || (record->path = strdup(path)) == NULL) {
+        free(record);
+        return;
+    }
+    record->entry_type = is_dir ? DOSSIER : FICHIER;
+    record->inode = entry_stat.st_ino;
+    record->mtime = entry_stat.st_mtim;
+    record->ctime = entry_stat.st_ctim;
+    if (!is_dir) {
+        record->size = entry_stat.st_size;
+        memcpy(record->md5sum, listed_entry->md5sum, sizeof(record->md5sum));
+        memcpy(record->fingerprint, listed_entry->fingerprint, sizeof(record->fingerprint));
+        record->digests = get_digests();
+    }
+    add_record(cache, record);
+}
+
+/*!
+ * @brief add_child adds a listed entry to the children of its directory record, if the directory was recorded
+ * @param cache is a pointer to the new cache
+ * @param entry is the listed entry
+ */
+static void add_child(dir_cache_t *cache, files_list_entry_t *entry) {
+    char *name = strrchr(entry->path_and_name, '/');
+    if (name == NULL) {
+        return;
+    }
+    *name = '\0';
+    dir_cache_record_t *parent = find_record(cache, entry->path_and_name);
+    *name++ = '/';
+    if (parent == NULL || parent->entry_type != DOSSIER) {
+        return;
+    }
+    size_t child_size = strlen(name) + 2;
+    char *children = realloc(parent->children, parent->children_size + child_size);
+    if (children == NULL) {
+        // An incomplete listing must not be reused
+        parent->entry_type = FICHIER;
+        return;
+    }
+    children[parent->children_size] = (char) entry->entry_type;
+    strcpy(children + parent->children_size + 1, name);
+    parent->children = children;
+    parent->children_size += child_size;
+    ++parent->entries_count;
+}
+
+/*!
+ * @brief save_dir_cache saves the records of the listed trees for the next synchronization
+ * Entries are checked again when they are recorded: those changed since the listing (e.g. destination directories
+ * the files were copied into) are not recorded, so they will be read or hashed again.
+ * @param the_config is a pointer to the configuration
+ * @param source_list is the list of the source tree
+ * @param destination_list is the list of the destination tree
+ * @param listing_start is the time when the listing started (CLOCK_REALTIME, as the timestamps of the files)
+ * @return 0 in case of success, -1 else
+ */
+int save_dir_cache(configuration_t *the_config, files_list_t *source_list, files_list_t *destination_list, struct timespec *listing_start) {
+    char path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+    dir_cache_t cache;
+    if (dir_cache_path(path, the_config) == NULL || snprintf(temporary_path, sizeof(temporary_path), "%s%s", path, ".tmp") >= (int) sizeof(temporary_path)) {
+        return -1;
+    }
+    size_t count = 2;
+    files_list_t *lists[2] = {source_list, destination_list};
+    for (int i=0; i<2; ++i) {
+        for (files_list_entry_t *cursor = lists[i]->head; cursor != NULL; cursor = cursor->next) {
+            ++count;
+        }
+    }
+    if (init_cache(&cache, count) != 0) {
+        return -1;
+    }
+
+    record_entry(&cache, the_config->source, NULL, listing_start);
+    record_entry(&cache, the_config->destination, NULL, listing_start);
+    for (int i=0; i<2; ++i) {
+        for (files_list_entry_t *cursor = lists[i]->head; cursor != NULL; cursor = cursor->next) {
+            record_entry(&cache, cursor->path_and_name, cursor, listing_start);
+        }
+    }
+    for (int i=0; i<2; ++i) {
+        for (files_list_entry_t *cursor = lists[i]->head; cursor != NULL; cursor = cursor->next) {
+            add_child(&cache, cursor);
+        }
+    }
+
+    FILE *stream = fopen(temporary_path, "wb");
+    if (stream == NULL) {
+        perror(temporary_path);
+        free_cache(&cache);
+        return -1;
+    }
+    uint64_t fingerprint = filter_fingerprint(&the_config->filter);
+    uint32_t runs_since_full_scan = current_cache.is_full_scan ? 0 : current_cache.runs_since_full_scan + 1;
+    uint64_t records_count = cache.count;
+    int result = (fwrite(DIR_CACHE_MAGIC, 1, strlen(DIR_CACHE_MAGIC), stream) == strlen(DIR_CACHE_MAGIC)
+        && write_string(stream, the_config->source) == 0 && write_string(stream, the_config->destination) == 0
+        && fwrite(&fingerprint, sizeof(fingerprint), 1, stream) == 1 && fwrite(&runs_since_full_scan, sizeof(runs_since_full_scan), 1, stream) == 1
+        && fwrite(&records_count, sizeof(records_count), 1, stream) == 1) ? 0 : -1;
+    for (size_t i=0; result == 0 && i<cache.buckets_count; ++i) {
+        for (dir_cache_record_t *cursor = cache.buckets[i]; result == 0 && cursor != NULL; cursor = cursor->next) {
+            result = write_record(stream, cursor);
+        }
+    }
+    if (fclose(stream) != 0) {
+        result = -1;
+    }
+    free_cache(&cache);
+    if (result == 0 && rename(temporary_path, path) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        perror(path);
+        unlink(temporary_path);
+    }
+    return result;
+}
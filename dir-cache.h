@@ -0,0 +1,40 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Record of an entry as it was at the end of the previous synchronization
+typedef struct dir_cache_record_s {
+    char *path;
+    file_type_t entry_type;
+    uint64_t inode;
+    struct timespec mtime;
+    struct timespec ctime;
+    uint64_t size;
+    uint8_t md5sum[16];
+    uint8_t fingerprint[16];
+    uint8_t digests; // Digests of the file known by the record (DIGEST_MD5, DIGEST_FINGERPRINT)
+    uint32_t entries_count; // Number of child entries of a directory
+    uint32_t children_size;
+    char *children; // Child entries of a directory, each one is its type (one byte) followed by its name and '\0'
+    struct dir_cache_record_s *next;
+} dir_cache_record_t;
+
+typedef struct {
+    dir_cache_record_t **buckets;
+    size_t buckets_count;
+    size_t count;
+    uint32_t runs_since_full_scan;
+    bool is_full_scan; // Records are not used during a full scan, only compared with what is found
+} dir_cache_t;
+
+int load_dir_cache(configuration_t *the_config);
+void clear_dir_cache(void);
+bool is_dir_cache_full_scan(void);
+dir_cache_record_t *find_cached_directory(char *path, struct stat *dir_stat);
+bool reuse_cached_digest(files_list_entry_t *entry, struct stat *file_stat);
+void check_cached_digest(files_list_entry_t *entry, struct stat *file_stat);
+int save_dir_cache(configuration_t *the_config, files_list_t *source_list, files_list_t *destination_list, struct timespec *listing_start);
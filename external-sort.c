@@ -0,0 +1,266 @@
+#include <external-sort.h>
+#include <utility.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*!
+ * @brief init_external_sorter initializes an empty sorter
+ * Half of the memory budget is for the entries kept in memory before they are written to a run, the other half for
+ * the runs merged at the same time (@see RUN_MERGE_COST).
+ * @param sorter is a pointer to the sorter
+ * @param memory_limit is the memory budget in bytes
+ * @param temporary_dir is the directory where the runs are written
+ * @return 0 in case of success, -1 else
+ */
+int init_external_sorter(external_sorter_t *sorter, size_t memory_limit, char *temporary_dir) {
+    memset(sorter, 0, sizeof(external_sorter_t));
+    if (strlen(temporary_dir) >= sizeof(sorter->temporary_dir)) {
+        return -1;
+    }
+    strcpy(sorter->temporary_dir, temporary_dir);
+    sorter->max_memory_count = memory_limit / 2 / sizeof(files_list_entry_t);
+    if (sorter->max_memory_count == 0) {
+        sorter->max_memory_count = 1;
+    }
+    sorter->fan_in = memory_limit / 2 / RUN_MERGE_COST;
+    if (sorter->fan_in < 2) {
+        sorter->fan_in = 2;
+    } else if (sorter->fan_in > MAX_MERGE_FAN_IN) {
+        sorter->fan_in = MAX_MERGE_FAN_IN;
+    }
+    sorter->heads = malloc(sorter->fan_in * sizeof(files_list_entry_t));
+    sorter->heap = malloc(sorter->fan_in * sizeof(int));
+    if (sorter->heads == NULL || sorter->heap == NULL) {
+        clear_external_sorter(sorter);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief new_run creates an empty run file
+ * The file is removed from the directory as soon as it is created: it disappears when it is closed, even if the
+ * program is killed.
+ * @param sorter is a pointer to the sorter
+ * @return a pointer to the stream of the run, NULL in case of error
+ */
+static FILE *new_run(external_sorter_t *sorter) {
+    char path[PATH_SIZE];
+    if (concat_path(path, sorter->temporary_dir, STATE_FILES_PREFIX ".run.XXXXXX") == NULL) {
+        return NULL;
+    }
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    unlink(path);
+    FILE *run = fdopen(fd, "w+b");
+    if (run == NULL) {
+        close(fd);
+        return NULL;
+    }
+    FILE **runs = realloc(sorter->runs, (sorter->runs_count + 1) * sizeof(FILE *));
+    if (runs == NULL) {
+        fclose(run);
+        return NULL;
+    }
+    sorter->runs = runs;
+    sorter->runs[sorter->runs_count++] = run;
+    return run;
+}
+
+/*!
+ * @brief spill_memory sorts the entries kept in memory and writes them to a new run
+ * @param sorter is a pointer to the sorter
+ * @return 0 in case of success, -1 else
+ */
+static int spill_memory(external_sorter_t *sorter) {
+    FILE *run = new_run(sorter);
+    if (run == NULL) {
+        return -1;
+    }
+    sort_files_list(&sorter->memory);
+    int result = 0;
+    for (files_list_entry_t *cursor = sorter->memory.head; cursor != NULL && result == 0; cursor = cursor->next) {
+        result = write_files_list_entry(run, cursor);
+    }
+    clear_files_list(&sorter->memory);
+    sorter->memory_count = 0;
+    if (result != 0) {
+        perror("run");
+    }
+    return result;
+}
+
+/*!
+ * @brief external_sorter_add adds an entry to sort, the entries kept in memory are written to a run when the
+ * budget is reached
+ * @param sorter is a pointer to the sorter
+ * @param entry is a pointer to the entry, which is copied
+ * @return 0 in case of success, -1 else
+ */
+int external_sorter_add(external_sorter_t *sorter, files_list_entry_t *entry) {
+    if (add_entry_to_tail(&sorter->memory, entry) != 0) {
+        return -1;
+    }
+    if (++sorter->memory_count >= sorter->max_memory_count) {
+        return spill_memory(sorter);
+    }
+    return 0;
+}
+
+/*!
+ * @brief heap_less tells if the current entry of a run comes before the one of another run
+ * @param sorter is a pointer to the sorter
+ * @param lhd is the index of the first run
+ * @param rhd is the index of the second run
+ * @return true if the entry of lhd comes first
+ */
+static bool heap_less(external_sorter_t *sorter, int lhd, int rhd) {
+    return strcmp(sorter->heads[lhd].path_and_name, sorter->heads[rhd].path_and_name) < 0;
+}
+
+/*!
+ * @brief heap_sift_down moves a run of the heap down to its place
+ * @param sorter is a pointer to the sorter
+ * @param position is the position of the run in the heap
+ */
+static void heap_sift_down(external_sorter_t *sorter, int position) {
+    while (true) {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < sorter->heap_count && heap_less(sorter, sorter->heap[left], sorter->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < sorter->heap_count && heap_less(sorter, sorter->heap[right], sorter->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        int swap = sorter->heap[position];
+        sorter->heap[position] = sorter->heap[smallest];
+        sorter->heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+/*!
+ * @brief start_merge starts reading runs in order
+ * @param sorter is a pointer to the sorter
+ * @param runs is the array of the runs to merge, at most fan_in runs
+ * @param count is the number of runs
+ */
+static void start_merge(external_sorter_t *sorter, FILE **runs, int count) {
+    sorter->merged_runs = runs;
+    sorter->heap_count = 0;
+    for (int i=0; i<count; ++i) {
+        fflush(runs[i]);
+        rewind(runs[i]);
+        if (read_files_list_entry(runs[i], &sorter->heads[i]) == 0) {
+            sorter->heap[sorter->heap_count++] = i;
+        }
+    }
+    for (int i=sorter->heap_count/2 - 1; i>=0; --i) {
+        heap_sift_down(sorter, i);
+    }
+}
+
+/*!
+ * @brief merge_next gives the next entry of the runs being merged
+ * @param sorter is a pointer to the sorter
+ * @return a pointer to the entry (valid until the next call), NULL when all the runs are read
+ */
+static files_list_entry_t *merge_next(external_sorter_t *sorter) {
+    if (sorter->heap_count == 0) {
+        return NULL;
+    }
+    int top = sorter->heap[0];
+    memcpy(&sorter->current, &sorter->heads[top], sizeof(files_list_entry_t));
+    if (read_files_list_entry(sorter->merged_runs[top], &sorter->heads[top]) != 0) {
+        sorter->heap[0] = sorter->heap[--sorter->heap_count];
+    }
+    heap_sift_down(sorter, 0);
+    return &sorter->current;
+}
+
+/*!
+ * @brief external_sorter_finish ends the additions, and prepares the entries to be read in order
+ * When there are more runs than can be merged at the same time, runs are merged into bigger runs first.
+ * @param sorter is a pointer to the sorter
+ * @return 0 in case of success, -1 else
+ */
+int external_sorter_finish(external_sorter_t *sorter) {
+    if (sorter->runs_count == 0) {
+        // Everything fits in memory
+        sort_files_list(&sorter->memory);
+        sorter->memory_cursor = sorter->memory.head;
+        return 0;
+    }
+    if (sorter->memory_count > 0 && spill_memory(sorter) != 0) {
+        return -1;
+    }
+
+    while (sorter->runs_count > sorter->fan_in) {
+        FILE **merged = malloc(sorter->fan_in * sizeof(FILE *));
+        if (merged == NULL) {
+            return -1;
+        }
+        memcpy(merged, sorter->runs, sorter->fan_in * sizeof(FILE *));
+        memmove(sorter->runs, sorter->runs + sorter->fan_in, (sorter->runs_count - sorter->fan_in) * sizeof(FILE *));
+        sorter->runs_count -= sorter->fan_in;
+
+        FILE *run = new_run(sorter);
+        int result = (run == NULL) ? -1 : 0;
+        if (result == 0) {
+            start_merge(sorter, merged, sorter->fan_in);
+            files_list_entry_t *entry;
+            while (result == 0 && (entry = merge_next(sorter)) != NULL) {
+                result = write_files_list_entry(run, entry);
+            }
+        }
+        for (int i=0; i<sorter->fan_in; ++i) {
+            fclose(merged[i]);
+        }
+        free(merged);
+        if (result != 0) {
+            return -1;
+        }
+    }
+    start_merge(sorter, sorter->runs, sorter->runs_count);
+    return 0;
+}
+
+/*!
+ * @brief external_sorter_next gives the next entry in path order (@see external_sorter_finish)
+ * @param sorter is a pointer to the sorter
+ * @return a pointer to the entry (valid until the next call), NULL after the last entry
+ */
+files_list_entry_t *external_sorter_next(external_sorter_t *sorter) {
+    if (sorter->runs_count == 0) {
+        files_list_entry_t *entry = sorter->memory_cursor;
+        if (entry != NULL) {
+            sorter->memory_cursor = entry->next;
+        }
+        return entry;
+    }
+    return merge_next(sorter);
+}
+
+/*!
+ * @brief clear_external_sorter frees the entries and the runs of a sorter
+ * @param sorter is a pointer to the sorter
+ */
+void clear_external_sorter(external_sorter_t *sorter) {
+    clear_files_list(&sorter->memory);
+    for (int i=0; i<sorter->runs_count; ++i) {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    free(sorter->heads);
+    free(sorter->heap);
+    memset(sorter, 0, sizeof(external_sorter_t));
+}
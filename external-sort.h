@@ -0,0 +1,36 @@
+#pragma once
+
+#include <files-list.h>
+#include <defines.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Memory used by each run merged at the same time: its stream buffer and its current entry
+#define RUN_MERGE_COST (BUFSIZ + sizeof(files_list_entry_t))
+// Maximum number of runs merged at the same time, each one uses a file descriptor
+#define MAX_MERGE_FAN_IN 256
+
+// Sorts entries by path within a memory budget: entries are kept in memory until the budget is reached, then they are
+// sorted and written to a temporary file (a run). Runs are merged when the entries are read back in order.
+typedef struct {
+    files_list_t memory; // Entries not written to a run yet
+    size_t memory_count;
+    size_t max_memory_count;
+    char temporary_dir[PATH_SIZE]; // Directory of the runs, their files are removed as soon as they are created
+    FILE **runs;
+    int runs_count;
+    int fan_in;
+    files_list_entry_t *heads; // Current entry of each merged run
+    int *heap; // Merged runs, ordered by the path of their current entry
+    int heap_count;
+    FILE **merged_runs; // Runs being merged
+    files_list_entry_t *memory_cursor; // Next entry when nothing was written to a run
+    files_list_entry_t current; // Last entry read from the runs
+} external_sorter_t;
+
+int init_external_sorter(external_sorter_t *sorter, size_t memory_limit, char *temporary_dir);
+int external_sorter_add(external_sorter_t *sorter, files_list_entry_t *entry);
+int external_sorter_finish(external_sorter_t *sorter);
+files_list_entry_t *external_sorter_next(external_sorter_t *sorter);
+void clear_external_sorter(external_sorter_t *sorter);
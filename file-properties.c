@@ -1,9 +1,14 @@
+#define _GNU_SOURCE // O_DIRECT
 // File includes
 #include <file-properties.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <utility.h>
 #include <defines.h>
+#include <stats.h>
+#include <cache-policy.h>
+#include <throttle.h>
+#include <dir-cache.h>
 
 // Librabry includes
 #include <stdio.h>
@@ -14,8 +19,29 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
 
 
+// Set by prepare before the processes are created, so that they all share it
+static uint8_t current_digests = DIGEST_MD5;
+
+/*!
+ * @brief set_digests sets the digests computed for the files
+ * @param digests is DIGEST_MD5, DIGEST_FINGERPRINT (--quick-hash), both, or 0 (--date-size-only)
+ */
+void set_digests(uint8_t digests) {
+    current_digests = digests;
+}
+
+/*!
+ * @brief get_digests gives the digests computed for the files
+ * @return DIGEST_MD5, DIGEST_FINGERPRINT or both
+ */
+uint8_t get_digests(void) {
+    return current_digests;
+}
+
 /*!
  * @brief get_file_stats gets all of the required information for a file (inc. directories)
  * @param the files list entry
@@ -25,7 +51,7 @@
  *   - mtime (in nanoseconds)
  *   - size
  *   - entry type (FICHIER)
- *   - MD5 sum
+ *   - MD5 sum, or the quick fingerprint (@see set_digests)
  * - for directories:
  *   - mode
  *   - entry type (DOSSIER)
@@ -39,14 +65,24 @@ int get_file_stats(files_list_entry_t *entry) {
     entry->mode = fileStat.st_mode;
     entry->mtime = fileStat.st_mtim;
 
-    if(S_ISDIR(fileStat.st_mode))
+    if(S_ISDIR(fileStat.st_mode)) {
         entry->entry_type = DOSSIER;
-    else {
+        entry->size = 0;
+        memset(entry->md5sum, 0, sizeof(entry->md5sum));
+    } else {
         entry->entry_type = FICHIER;
         entry->size = fileStat.st_size;
 
-        if(compute_file_md5(entry) != 0)
+        // fichier inchangé depuis la synchronisation précédente (--dir-cache)
+        if(reuse_cached_digest(entry, &fileStat))
+            return 0;
+        memset(entry->md5sum, 0, sizeof(entry->md5sum));
+        memset(entry->fingerprint, 0, sizeof(entry->fingerprint));
+        if((current_digests & DIGEST_MD5) != 0 && compute_file_md5(entry) != 0)
             return -1;
+        if((current_digests & DIGEST_FINGERPRINT) != 0 && compute_file_fingerprint(entry) != 0)
+            return -1;
+        check_cached_digest(entry, &fileStat);
     }
 
     return 0;
@@ -60,41 +96,260 @@ int get_file_stats(files_list_entry_t *entry) {
  * Use libcrypto functions from openssl/evp.h
  */
 int compute_file_md5(files_list_entry_t *entry) {
+    uint64_t start = stats_clock();
     FILE *inFile = fopen(entry->path_and_name, "rb");
     EVP_MD_CTX *mdctx;
     unsigned char data[1024];
     int bytes;
     unsigned int md_len;
+    cache_window_t window;
+    off_t position = 0;
+    uint64_t unpublished = 0; // Bytes hashed but not yet counted in the shared statistics and throttle
 
     if (inFile == NULL) {
         printf("%s can't be opened.\n", entry->path_and_name);
         return -1;
     }
+    cache_window_open(&window, fileno(inFile), false);
+    throttle_consume(THROTTLE_FILES, 1);
 
-    if((mdctx = EVP_MD_CTX_new()) == NULL)
+    if((mdctx = EVP_MD_CTX_new()) == NULL) {
+        cache_window_close(&window);
+        fclose(inFile);
         return -1;
+    }
 
     if(1 != EVP_DigestInit_ex(mdctx, EVP_md5(), NULL)) {
         EVP_MD_CTX_free(mdctx);
+        cache_window_close(&window);
+        fclose(inFile);
         return -1;
     }
 
     while ((bytes = fread(data, 1, 1024, inFile)) != 0) {
         if(1 != EVP_DigestUpdate(mdctx, data, bytes)) {
             EVP_MD_CTX_free(mdctx);
+            cache_window_close(&window);
+            fclose(inFile);
             return -1;
         }
+        position += bytes;
+        cache_window_advance(&window, position);
+        // The shared counters are atomics contended by all the analyzers: update them once per chunk
+        unpublished += bytes;
+        if (unpublished >= COPY_CHUNK_SIZE) {
+            stats_add(STAT_BYTES_HASHED, unpublished);
+            throttle_consume(THROTTLE_READ_BYTES, unpublished);
+            unpublished = 0;
+        }
     }
+    stats_add(STAT_BYTES_HASHED, unpublished);
+    throttle_consume(THROTTLE_READ_BYTES, unpublished);
 
     if(1 != EVP_DigestFinal_ex(mdctx, entry->md5sum, &md_len)) {
         EVP_MD_CTX_free(mdctx);
+        cache_window_close(&window);
+        fclose(inFile);
         return -1;
     }
 
     EVP_MD_CTX_free(mdctx);
+    cache_window_close(&window);
     fclose(inFile);
+    stats_add(STAT_FILES_HASHED, 1);
+    stats_add_time(STAT_HASH_NS, start);
+    stats_record_latency(HISTOGRAM_HASH_LATENCY, start);
+    return 0;
+}
+/*!
+ * @brief fingerprint_covers_file tells if the quick fingerprint of a file is computed from all its content
+ * @param size is the size of the file
+ * @return true if all the blocks of the file are sampled, so that equal fingerprints mean equal contents
+ */
+bool fingerprint_covers_file(uint64_t size) {
+    return size <= (uint64_t) (QUICK_HASH_STRIDE_BLOCKS + 2) * QUICK_HASH_BLOCK_SIZE;
+}
+
+/*!
+ * @brief compute_file_fingerprint computes the quick fingerprint of a file (--quick-hash)
+ * The fingerprint is the MD5 sum of the size, the first and last blocks, and QUICK_HASH_STRIDE_BLOCKS blocks evenly
+ * spaced in between. Small files are hashed completely. The size must already be in the entry.
+ * @param entry is the pointer to the files list entry
+ * @return -1 in case of error, 0 else
+ */
+int compute_file_fingerprint(files_list_entry_t *entry) {
+    uint64_t start = stats_clock();
+    int fd = open(entry->path_and_name, O_RDONLY);
+    if (fd < 0) {
+        printf("%s can't be opened.\n", entry->path_and_name);
+        return -1;
+    }
+    // Only the sampled blocks are read, without read ahead
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    throttle_consume(THROTTLE_FILES, 1);
+
+    unsigned char *data = malloc(QUICK_HASH_BLOCK_SIZE);
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    int result = (data != NULL && mdctx != NULL && EVP_DigestInit_ex(mdctx, EVP_md5(), NULL) == 1
+                  && EVP_DigestUpdate(mdctx, &entry->size, sizeof(entry->size)) == 1) ? 0 : -1;
+    uint64_t blocks_count = fingerprint_covers_file(entry->size) ? (entry->size + QUICK_HASH_BLOCK_SIZE - 1) / QUICK_HASH_BLOCK_SIZE : QUICK_HASH_STRIDE_BLOCKS + 2;
+    for (uint64_t i=0; result == 0 && i<blocks_count; ++i) {
+        // Blocks are evenly spaced from the head to the tail, aligned on the block size except the tail
+        off_t offset = i * QUICK_HASH_BLOCK_SIZE;
+        if (!fingerprint_covers_file(entry->size)) {
+            uint64_t last = entry->size - QUICK_HASH_BLOCK_SIZE;
+            offset = (i == blocks_count - 1) ? last : (last * i / (blocks_count - 1)) / QUICK_HASH_BLOCK_SIZE * QUICK_HASH_BLOCK_SIZE;
+        }
+        ssize_t bytes = pread(fd, data, QUICK_HASH_BLOCK_SIZE, offset);
+        if (bytes < 0 || EVP_DigestUpdate(mdctx, data, bytes) != 1) {
+            result = -1;
+            break;
+        }
+        stats_add(STAT_BYTES_SAMPLED, bytes);
+        throttle_consume(THROTTLE_READ_BYTES, bytes);
+        if (is_cache_friendly()) {
+            posix_fadvise(fd, offset, bytes, POSIX_FADV_DONTNEED);
+        }
+    }
+    unsigned int md_len;
+    if (result == 0 && EVP_DigestFinal_ex(mdctx, entry->fingerprint, &md_len) != 1) {
+        result = -1;
+    }
+
+    EVP_MD_CTX_free(mdctx);
+    free(data);
+    close(fd);
+    if (result == 0) {
+        stats_add(STAT_FILES_SAMPLED, 1);
+        stats_add_time(STAT_HASH_NS, start);
+        stats_record_latency(HISTOGRAM_HASH_LATENCY, start);
+    } else {
+        perror(entry->path_and_name);
+    }
+    return result;
+}
+
+// Runs with --quick-hash since the last full hash pass, when there is no directory cache to count them
+#define QUICK_HASH_RUNS_MAGIC "LP25QHR1"
+static uint32_t quick_hash_runs = 0;
+static bool is_quick_hash_full_pass = true;
+
+/*!
+ * @brief load_quick_hash_runs tells if a run with --quick-hash is a full hash pass, without --dir-cache
+ * The runs since the last full pass are counted in a file of the destination: every full_scan_every runs, as the full
+ * scans of the directory cache, the MD5 sums are computed as well. There is a full pass when the file is missing.
+ * @param the_config is a pointer to the configuration
+ * @return true if the MD5 sums must be computed by this run, false else
+ */
+bool load_quick_hash_runs(configuration_t *the_config) {
+    char path[PATH_SIZE];
+    char magic[sizeof(QUICK_HASH_RUNS_MAGIC)] = {0};
+    char source[sizeof(the_config->source)];
+    uint32_t runs;
+    quick_hash_runs = 0;
+    is_quick_hash_full_pass = true;
+    FILE *stream = (concat_path(path, the_config->destination, QUICK_HASH_RUNS_FILE_NAME) != NULL) ? fopen(path, "rb") : NULL;
+    if (stream == NULL) {
+        return true;
+    }
+    // Runs counted for another source: the destination contents are not known to match it
+    if (fread(magic, 1, strlen(QUICK_HASH_RUNS_MAGIC), stream) == strlen(QUICK_HASH_RUNS_MAGIC) && strcmp(magic, QUICK_HASH_RUNS_MAGIC) == 0
+        && read_string(stream, source, sizeof(source)) == 0 && strcmp(source, the_config->source) == 0
+        && fread(&runs, sizeof(runs), 1, stream) == 1) {
+        quick_hash_runs = runs;
+        is_quick_hash_full_pass = the_config->full_scan_every <= 1 || runs + 1 >= the_config->full_scan_every;
+    }
+    fclose(stream);
+    return is_quick_hash_full_pass;
+}
+
+/*!
+ * @brief save_quick_hash_runs counts the run in the destination (@see load_quick_hash_runs)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int save_quick_hash_runs(configuration_t *the_config) {
+    char path[PATH_SIZE];
+    if (concat_path(path, the_config->destination, QUICK_HASH_RUNS_FILE_NAME) == NULL) {
+        return -1;
+    }
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL) {
+        perror(path);
+        return -1;
+    }
+    uint32_t runs = is_quick_hash_full_pass ? 0 : quick_hash_runs + 1;
+    int result = (fwrite(QUICK_HASH_RUNS_MAGIC, 1, strlen(QUICK_HASH_RUNS_MAGIC), stream) == strlen(QUICK_HASH_RUNS_MAGIC)
+        && write_string(stream, the_config->source) == 0 && fwrite(&runs, sizeof(runs), 1, stream) == 1) ? 0 : -1;
+    if (fclose(stream) != 0 || result != 0) {
+        perror(path);
+        return -1;
+    }
     return 0;
 }
+
+/*!
+ * @brief compute_file_md5_uncached computes the MD5 sum of a file from its storage, not from the page cache
+ * The file is read with O_DIRECT. When the filesystem doesn't support it, the file is written back and dropped from
+ * the page cache before it is read.
+ * @param path is the path of the file
+ * @param md5sum receives the MD5 sum
+ * @return -1 in case of error, 0 else
+ */
+int compute_file_md5_uncached(char *path, unsigned char *md5sum) {
+    uint64_t start = stats_clock();
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+    }
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // O_DIRECT needs buffers, sizes and offsets aligned on the blocks of the device
+    void *data;
+    if (posix_memalign(&data, DIRECT_IO_ALIGNMENT, COPY_CHUNK_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    int result = (mdctx != NULL && EVP_DigestInit_ex(mdctx, EVP_md5(), NULL) == 1) ? 0 : -1;
+    ssize_t bytes = 0;
+    // A short read is the end of the file: the next read would not be aligned
+    while (result == 0 && (bytes = read(fd, data, COPY_CHUNK_SIZE)) > 0) {
+        if (EVP_DigestUpdate(mdctx, data, bytes) != 1) {
+            result = -1;
+        }
+        stats_add(STAT_BYTES_VERIFIED, bytes);
+        throttle_consume(THROTTLE_READ_BYTES, bytes);
+        if (bytes < COPY_CHUNK_SIZE) {
+            break;
+        }
+    }
+    if (result == 0 && bytes < 0) {
+        perror(path);
+        result = -1;
+    }
+    unsigned int md_len;
+    if (result == 0 && EVP_DigestFinal_ex(mdctx, md5sum, &md_len) != 1) {
+        result = -1;
+    }
+
+    EVP_MD_CTX_free(mdctx);
+    free(data);
+    close(fd);
+    if (result == 0) {
+        stats_add(STAT_FILES_VERIFIED, 1);
+        stats_add_time(STAT_HASH_NS, start);
+    }
+    return result;
+}
+
 /*!
  * @brief directory_exists tests the existence of a directory
  * @path_to_dir a string with the path to the directory
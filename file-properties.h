@@ -4,7 +4,18 @@
 #include <stdbool.h>
 #include <configuration.h>
 
+// Digests computed for the files by get_file_stats
+#define DIGEST_MD5 0x1
+#define DIGEST_FINGERPRINT 0x2
+
+void set_digests(uint8_t digests);
+uint8_t get_digests(void);
 int get_file_stats(files_list_entry_t *entry);
 int compute_file_md5(files_list_entry_t *entry);
+int compute_file_fingerprint(files_list_entry_t *entry);
+bool fingerprint_covers_file(uint64_t size);
+bool load_quick_hash_runs(configuration_t *the_config);
+int save_quick_hash_runs(configuration_t *the_config);
+int compute_file_md5_uncached(char *path, unsigned char *md5sum);
 bool directory_exists(char *path_to_dir);
 bool is_directory_writable(char *path_to_dir);
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include <files-list.h>
+#include <file-properties.h>
+#include <utility.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +18,7 @@ void clear_files_list(files_list_t *list) {
         list->head = tmp->next;
         free(tmp);
     }
+    list->tail = NULL;
 }
 
 /*!
@@ -47,28 +50,39 @@ files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
     // Initialize the new entry
     strcpy(newEntry->path_and_name, file_path);
 
-    // Use get_file_stats to fill basic properties
+    // Use get_file_stats to fill basic properties (it also computes the md5sum of files)
     if (get_file_stats(newEntry) != 0) {
         // Failed to get file stats
         free(newEntry);
         return NULL;
     }
 
-    // Use compute_file_md5 to calculate md5sum
-    if (compute_file_md5(newEntry) != 0) {
-        // Failed to compute md5sum
-        free(newEntry);
-        return NULL;
+    // Look for the first element greater than the new one to keep the list ordered
+    files_list_entry_t *cursor = list->head;
+    while (cursor != NULL && strcmp(cursor->path_and_name, file_path) < 0) {
+        cursor = cursor->next;
     }
 
-    // Initialize other properties (next, prev) as needed
-    newEntry->next = NULL;
-    newEntry->prev = NULL;
-
-    // Add the entry to the tail of the list
-    if (add_entry_to_tail(list, newEntry) != 0) {
-        free(newEntry);
-        return NULL;  // Failed to add entry to the list
+    if (cursor == NULL) {
+        // Nothing greater: the entry goes to the tail
+        newEntry->next = NULL;
+        newEntry->prev = list->tail;
+        if (list->tail == NULL) {
+            list->head = newEntry;
+        } else {
+            list->tail->next = newEntry;
+        }
+        list->tail = newEntry;
+    } else {
+        // Insert the entry before cursor
+        newEntry->next = cursor;
+        newEntry->prev = cursor->prev;
+        if (cursor->prev == NULL) {
+            list->head = newEntry;
+        } else {
+            cursor->prev->next = newEntry;
+        }
+        cursor->prev = newEntry;
     }
 
     return newEntry;
@@ -112,6 +126,102 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
     return 0;  // Success
 }
 
+/*!
+ * @brief remove_entry_from_list removes an entry from a list and frees it
+ * @param list is a pointer to the list
+ * @param entry is a pointer to the entry to remove, it must belong to list
+ */
+void remove_entry_from_list(files_list_t *list, files_list_entry_t *entry) {
+    if (list == NULL || entry == NULL) {
+        return;
+    }
+    if (entry->prev == NULL) {
+        list->head = entry->next;
+    } else {
+        entry->prev->next = entry->next;
+    }
+    if (entry->next == NULL) {
+        list->tail = entry->prev;
+    } else {
+        entry->next->prev = entry->prev;
+    }
+    free(entry);
+}
+
+/*!
+ * @brief merge_sorted_chains merges two singly chained (next only) ordered sequences of entries
+ * @param left the first ordered sequence
+ * @param right the second ordered sequence
+ * @return the head of the merged sequence
+ */
+static files_list_entry_t *merge_sorted_chains(files_list_entry_t *left, files_list_entry_t *right) {
+    files_list_entry_t head;
+    files_list_entry_t *tail = &head;
+
+    while (left != NULL && right != NULL) {
+        // <= keeps the sort stable
+        if (strcmp(left->path_and_name, right->path_and_name) <= 0) {
+            tail->next = left;
+            left = left->next;
+        } else {
+            tail->next = right;
+            right = right->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = (left != NULL) ? left : right;
+    return head.next;
+}
+
+/*!
+ * @brief sort_files_list sorts a files list by path (strcmp order)
+ * It is a bottom-up merge sort on the next pointers, the prev pointers and the tail are rebuilt afterwards.
+ * Building a list with add_entry_to_tail then sorting it is O(n log n), where add_file_entry is O(n) per element.
+ * @param list is a pointer to the list to sort
+ */
+void sort_files_list(files_list_t *list) {
+    if (list == NULL || list->head == NULL) {
+        return;
+    }
+
+    // Split the list into single element chains, then merge them pairwise until only one remains
+    size_t count = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        ++count;
+    }
+    files_list_entry_t **chains = malloc(count * sizeof(files_list_entry_t *));
+    if (chains == NULL) {
+        return;
+    }
+    size_t i = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; ) {
+        files_list_entry_t *next = cursor->next;
+        cursor->next = NULL;
+        chains[i++] = cursor;
+        cursor = next;
+    }
+    while (count > 1) {
+        size_t merged = 0;
+        for (i=0; i+1<count; i+=2) {
+            chains[merged++] = merge_sorted_chains(chains[i], chains[i+1]);
+        }
+        if (count % 2 == 1) {
+            chains[merged++] = chains[count-1];
+        }
+        count = merged;
+    }
+
+    // Restore the double chaining
+    list->head = chains[0];
+    files_list_entry_t *prev = NULL;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        cursor->prev = prev;
+        prev = cursor;
+    }
+    list->tail = prev;
+    free(chains);
+}
+
 /*!
  *  @brief find_entry_by_name looks up for a file in a list
  *  The function uses the ordering of the entries to interrupt its search
@@ -145,6 +255,117 @@ files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size
     return NULL;
 }
 
+// Version of the files holding a list, shared by all of them since they hold the same entries: it changes with the
+// format of the header or of the entries (@see write_files_list_entry)
+#define FILES_LIST_VERSION "4"
+
+/*!
+ * @brief write_files_list_header writes the header of a file holding a list
+ * The header is a magic (the kind of the file followed by the version of the format), the source and destination
+ * paths, the digests computed for the entries, and the entries count.
+ * @param stream is the stream to write into
+ * @param kind is the kind of the file (7 characters)
+ * @param header is a pointer to the header to write
+ * @return 0 in case of success, -1 else
+ */
+int write_files_list_header(FILE *stream, const char *kind, files_list_header_t *header) {
+    if (stream == NULL || kind == NULL || header == NULL
+        || fwrite(kind, 1, strlen(kind), stream) != strlen(kind)
+        || fwrite(FILES_LIST_VERSION, 1, strlen(FILES_LIST_VERSION), stream) != strlen(FILES_LIST_VERSION)
+        || write_string(stream, header->source) != 0 || write_string(stream, header->destination) != 0
+        || fwrite(&header->digests, sizeof(header->digests), 1, stream) != 1
+        || fwrite(&header->count, sizeof(header->count), 1, stream) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_files_list_header reads a header written by write_files_list_header
+ * @param stream is the stream to read from
+ * @param kind is the expected kind of the file
+ * @param header is a pointer to the header to fill
+ * @return 0 in case of success, -1 if the stream is not a file of this kind and version, or is truncated
+ */
+int read_files_list_header(FILE *stream, const char *kind, files_list_header_t *header) {
+    char magic[16] = {0};
+    size_t magic_length = strlen(kind) + strlen(FILES_LIST_VERSION);
+    if (stream == NULL || header == NULL || magic_length >= sizeof(magic)
+        || fread(magic, 1, magic_length, stream) != magic_length
+        || strncmp(magic, kind, strlen(kind)) != 0 || strcmp(magic + strlen(kind), FILES_LIST_VERSION) != 0
+        || read_string(stream, header->source, sizeof(header->source)) != 0
+        || read_string(stream, header->destination, sizeof(header->destination)) != 0
+        || fread(&header->digests, sizeof(header->digests), 1, stream) != 1
+        || fread(&header->count, sizeof(header->count), 1, stream) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief write_files_list_entry writes an entry to a binary stream
+ * The path is written with its length only, so that records are compact. Pointers are not written.
+ * @param stream is the stream to write into
+ * @param entry is a pointer to the entry to write
+ * @return 0 in case of success, -1 else
+ */
+int write_files_list_entry(FILE *stream, files_list_entry_t *entry) {
+    if (stream == NULL || entry == NULL) {
+        return -1;
+    }
+    uint16_t path_length = strlen(entry->path_and_name);
+    int64_t mtime[2] = {entry->mtime.tv_sec, entry->mtime.tv_nsec};
+    uint32_t mode = entry->mode;
+    uint8_t entry_type = entry->entry_type;
+
+    if (fwrite(&path_length, sizeof(path_length), 1, stream) != 1
+        || fwrite(entry->path_and_name, 1, path_length, stream) != path_length
+        || fwrite(mtime, sizeof(mtime), 1, stream) != 1
+        || fwrite(&entry->size, sizeof(entry->size), 1, stream) != 1
+        || fwrite(entry->md5sum, sizeof(entry->md5sum), 1, stream) != 1
+        || fwrite(entry->fingerprint, sizeof(entry->fingerprint), 1, stream) != 1
+        || fwrite(&entry_type, sizeof(entry_type), 1, stream) != 1
+        || fwrite(&mode, sizeof(mode), 1, stream) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_files_list_entry reads an entry written by write_files_list_entry
+ * @param stream is the stream to read from
+ * @param entry is a pointer to the entry to fill. Its pointers are set to NULL
+ * @return 0 in case of success, -1 else (end of stream or truncated record)
+ */
+int read_files_list_entry(FILE *stream, files_list_entry_t *entry) {
+    if (stream == NULL || entry == NULL) {
+        return -1;
+    }
+    uint16_t path_length;
+    int64_t mtime[2];
+    uint32_t mode;
+    uint8_t entry_type;
+
+    if (fread(&path_length, sizeof(path_length), 1, stream) != 1 || path_length >= sizeof(entry->path_and_name)
+        || fread(entry->path_and_name, 1, path_length, stream) != path_length
+        || fread(mtime, sizeof(mtime), 1, stream) != 1
+        || fread(&entry->size, sizeof(entry->size), 1, stream) != 1
+        || fread(entry->md5sum, sizeof(entry->md5sum), 1, stream) != 1
+        || fread(entry->fingerprint, sizeof(entry->fingerprint), 1, stream) != 1
+        || fread(&entry_type, sizeof(entry_type), 1, stream) != 1
+        || fread(&mode, sizeof(mode), 1, stream) != 1) {
+        return -1;
+    }
+    entry->path_and_name[path_length] = '\0';
+    entry->mtime.tv_sec = mtime[0];
+    entry->mtime.tv_nsec = mtime[1];
+    entry->entry_type = (entry_type == DOSSIER) ? DOSSIER : FICHIER;
+    entry->mode = mode;
+    entry->next = NULL;
+    entry->prev = NULL;
+    return 0;
+}
+
 /*!
  * @brief display_files_list displays a files list
  * @param list is the pointer to the list to be displayed
@@ -1,22 +1,33 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 #include <sys/types.h>
 
 typedef enum { FICHIER, DOSSIER } file_type_t;
 
+// path_and_name is the last field, so that messages carrying an entry only send the used part of the path
 typedef struct _files_list_entry {
-  char path_and_name[4096];
   struct timespec mtime;
   uint64_t size;
   uint8_t md5sum[16];
+  uint8_t fingerprint[16]; // MD5 sum of the size and of sampled blocks (--quick-hash)
   file_type_t entry_type;
   mode_t mode;
   struct _files_list_entry *next;
   struct _files_list_entry *prev;
+  char path_and_name[4096];
 } files_list_entry_t;
 
+// Header of the files holding a list (plans, journals)
+typedef struct {
+  char source[1024];
+  char destination[1024];
+  uint8_t digests; // Digests computed for the entries (@see set_digests)
+  uint64_t count;
+} files_list_header_t;
+
 typedef struct {
   struct _files_list_entry *head;
   struct _files_list_entry *tail;
@@ -25,6 +36,12 @@ typedef struct {
 void clear_files_list(files_list_t *list);
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
+void remove_entry_from_list(files_list_t *list, files_list_entry_t *entry);
+void sort_files_list(files_list_t *list);
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
+int write_files_list_header(FILE *stream, const char *kind, files_list_header_t *header);
+int read_files_list_header(FILE *stream, const char *kind, files_list_header_t *header);
+int write_files_list_entry(FILE *stream, files_list_entry_t *entry);
+int read_files_list_entry(FILE *stream, files_list_entry_t *entry);
 void display_files_list(files_list_t *list);
 void display_files_list_reversed(files_list_t *list);
@@ -0,0 +1,243 @@
+#include <filter.h>
+#include <defines.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Filter applied by the listings, set by prepare before the processes are created
+static filter_t *active_filter = NULL;
+
+/*!
+ * @brief key_hash computes the FNV-1a hash of a name or path
+ * @param key is the string to hash
+ * @return the bucket of the key
+ */
+static size_t key_hash(const char *key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *key != '\0'; ++key) {
+        hash = (hash ^ (uint8_t) *key) * 0x100000001b3ULL;
+    }
+    return hash % FILTER_BUCKETS_COUNT;
+}
+
+/*!
+ * @brief init_filter initializes an empty filter, that excludes nothing
+ * @param filter is a pointer to the filter
+ */
+void init_filter(filter_t *filter) {
+    memset(filter, 0, sizeof(filter_t));
+}
+
+/*!
+ * @brief add_filter_rule adds a rule after the existing ones, and compiles it
+ * Patterns are shell wildcards (@see fnmatch). A pattern ending with / only matches directories. A pattern starting
+ * with / or containing a / is anchored: it is matched against the whole path relative to the root (a * doesn't match
+ * a /), else it is matched against the name of the entries at any depth.
+ * An excluded directory is not walked, so its content is excluded too.
+ * @param filter is a pointer to the filter
+ * @param pattern is the pattern of the rule
+ * @param is_include is true for an include rule, false for an exclude rule
+ * @return 0 in case of success, -1 else
+ */
+int add_filter_rule(filter_t *filter, const char *pattern, bool is_include) {
+    filter_rule_t rule = {.is_include = is_include};
+    size_t length = strlen(pattern);
+    if (length > 0 && pattern[length - 1] == '/') {
+        rule.only_dirs = true;
+        --length;
+    }
+    if (length > 0 && pattern[0] == '/') {
+        rule.is_anchored = true;
+        ++pattern;
+        --length;
+    }
+    if (length == 0) {
+        return -1;
+    }
+    rule.pattern = strndup(pattern, length);
+    if (rule.pattern == NULL) {
+        return -1;
+    }
+    rule.is_anchored = rule.is_anchored || strchr(rule.pattern, '/') != NULL;
+
+    filter_rule_t *rules = realloc(filter->rules, (filter->rules_count + 1) * sizeof(filter_rule_t));
+    if (rules == NULL) {
+        free(rule.pattern);
+        return -1;
+    }
+    filter->rules = rules;
+    int index = filter->rules_count++;
+    filter->rules[index] = rule;
+
+    if (strpbrk(rule.pattern, "*?[\\") != NULL) {
+        int *glob_rules = realloc(filter->glob_rules, (filter->glob_rules_count + 1) * sizeof(int));
+        if (glob_rules == NULL) {
+            --filter->rules_count;
+            free(rule.pattern);
+            return -1;
+        }
+        filter->glob_rules = glob_rules;
+        filter->glob_rules[filter->glob_rules_count++] = index;
+        return 0;
+    }
+
+    literal_node_t *node = malloc(sizeof(literal_node_t));
+    if (node == NULL) {
+        --filter->rules_count;
+        free(rule.pattern);
+        return -1;
+    }
+    literal_node_t **buckets = rule.is_anchored ? filter->paths : filter->names;
+    size_t bucket = key_hash(rule.pattern);
+    node->key = rule.pattern;
+    node->rule = index;
+    node->next = buckets[bucket];
+    buckets[bucket] = node;
+    return 0;
+}
+
+/*!
+ * @brief load_filter_file adds the rules of a filter file
+ * Each line is a rule: "+ pattern" includes, "- pattern" or a bare pattern excludes. Empty lines and lines starting
+ * with # are ignored.
+ * @param filter is a pointer to the filter
+ * @param path is the path of the file
+ * @return 0 in case of success, -1 else
+ */
+int load_filter_file(filter_t *filter, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[PATH_SIZE];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if ((line[0] == '+' || line[0] == '-') && line[1] == ' ') {
+            result = add_filter_rule(filter, line + 2, line[0] == '+');
+        } else {
+            result = add_filter_rule(filter, line, false);
+        }
+        if (result != 0) {
+            fprintf(stderr, "%s: invalid rule %s\n", path, line);
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief clear_filter frees the rules of a filter, which excludes nothing afterwards
+ * @param filter is a pointer to the filter
+ */
+void clear_filter(filter_t *filter) {
+    for (int i=0; i<FILTER_BUCKETS_COUNT; ++i) {
+        for (literal_node_t *node = filter->names[i], *next; node != NULL; node = next) {
+            next = node->next;
+            free(node);
+        }
+        for (literal_node_t *node = filter->paths[i], *next; node != NULL; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    for (int i=0; i<filter->rules_count; ++i) {
+        free(filter->rules[i].pattern);
+    }
+    free(filter->rules);
+    free(filter->glob_rules);
+    init_filter(filter);
+}
+
+/*!
+ * @brief find_literal_rule finds the first literal rule matching a key
+ * @param filter is a pointer to the filter
+ * @param buckets is the hash table to look into (names or paths)
+ * @param key is the name or path of the entry
+ * @param is_dir tells if the entry is a directory
+ * @param first is the index of the first matching rule found so far
+ * @return the index of the first matching rule, first if there is none before it
+ */
+static int find_literal_rule(filter_t *filter, literal_node_t **buckets, const char *key, bool is_dir, int first) {
+    for (literal_node_t *node = buckets[key_hash(key)]; node != NULL; node = node->next) {
+        if (node->rule < first && (is_dir || !filter->rules[node->rule].only_dirs) && strcmp(node->key, key) == 0) {
+            first = node->rule;
+        }
+    }
+    return first;
+}
+
+/*!
+ * @brief filter_excludes tells if an entry is excluded by a filter
+ * Literal rules cost a lookup, and only the wildcard rules given before the first literal match are tried.
+ * @param filter is a pointer to the filter
+ * @param path is the path of the entry relative to its root
+ * @param is_dir tells if the entry is a directory
+ * @return true if the first matching rule is an exclude rule, false if it is an include rule or none matches
+ */
+bool filter_excludes(filter_t *filter, const char *path, bool is_dir) {
+    if (filter->rules_count == 0) {
+        return false;
+    }
+    const char *name = strrchr(path, '/');
+    name = (name == NULL) ? path : name + 1;
+
+    int first = filter->rules_count;
+    first = find_literal_rule(filter, filter->names, name, is_dir, first);
+    first = find_literal_rule(filter, filter->paths, path, is_dir, first);
+    for (int i=0; i<filter->glob_rules_count && filter->glob_rules[i] < first; ++i) {
+        filter_rule_t *rule = &filter->rules[filter->glob_rules[i]];
+        if (rule->only_dirs && !is_dir) {
+            continue;
+        }
+        if (fnmatch(rule->pattern, rule->is_anchored ? path : name, rule->is_anchored ? FNM_PATHNAME : 0) == 0) {
+            first = filter->glob_rules[i];
+        }
+    }
+    return first < filter->rules_count && !filter->rules[first].is_include;
+}
+
+/*!
+ * @brief filter_fingerprint computes a hash of the rules of a filter, to tell if they changed between two runs
+ * @param filter is a pointer to the filter
+ * @return the FNV-1a hash of the rules, in their order
+ */
+uint64_t filter_fingerprint(filter_t *filter) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i=0; i<filter->rules_count; ++i) {
+        filter_rule_t *rule = &filter->rules[i];
+        char flags[3] = {rule->is_include ? '+' : '-', rule->is_anchored ? '/' : '.', rule->only_dirs ? 'd' : 'f'};
+        for (size_t j=0; j<sizeof(flags); ++j) {
+            hash = (hash ^ (uint8_t) flags[j]) * 0x100000001b3ULL;
+        }
+        for (const char *cursor = rule->pattern; *cursor != '\0'; ++cursor) {
+            hash = (hash ^ (uint8_t) *cursor) * 0x100000001b3ULL;
+        }
+        hash = (hash ^ 0) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief use_filter sets the filter applied by the listings (@see is_filtered_out)
+ * @param filter is a pointer to the filter, NULL to list everything
+ */
+void use_filter(filter_t *filter) {
+    active_filter = filter;
+}
+
+/*!
+ * @brief is_filtered_out tells if an entry is excluded by the filter in use
+ * @param path is the path of the entry relative to its root
+ * @param is_dir tells if the entry is a directory
+ * @return true if the entry must not be listed, false else
+ */
+bool is_filtered_out(const char *path, bool is_dir) {
+    return active_filter != NULL && filter_excludes(active_filter, path, is_dir);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Patterns without wildcards are looked up in hash tables, the others are matched in order with fnmatch
+#define FILTER_BUCKETS_COUNT 64
+
+typedef struct {
+    char *pattern;
+    bool is_include;
+    bool is_anchored; // Matched against the path relative to the root instead of the entry name
+    bool only_dirs; // Pattern ending with /
+} filter_rule_t;
+
+typedef struct literal_node_s {
+    char *key;
+    int rule; // Index of the rule in the rules array
+    struct literal_node_s *next;
+} literal_node_t;
+
+typedef struct {
+    filter_rule_t *rules; // In the order they were given: the first matching rule wins
+    int rules_count;
+    int *glob_rules; // Indexes of the rules with wildcards, in increasing order
+    int glob_rules_count;
+    literal_node_t *names[FILTER_BUCKETS_COUNT]; // Literal rules on the entry name
+    literal_node_t *paths[FILTER_BUCKETS_COUNT]; // Literal anchored rules
+} filter_t;
+
+void init_filter(filter_t *filter);
+int add_filter_rule(filter_t *filter, const char *pattern, bool is_include);
+int load_filter_file(filter_t *filter, const char *path);
+void clear_filter(filter_t *filter);
+bool filter_excludes(filter_t *filter, const char *path, bool is_dir);
+uint64_t filter_fingerprint(filter_t *filter);
+void use_filter(filter_t *filter);
+bool is_filtered_out(const char *path, bool is_dir);
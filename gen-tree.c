@@ -0,0 +1,260 @@
+#include <utility.h>
+#include <defines.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Base mtime of the generated files, so that two generations with the same parameters are identical
+#define GEN_BASE_MTIME 1600000000
+#define GEN_BLOCK_SIZE (64 * 1024)
+
+typedef struct {
+    uint64_t files_count;
+    int depth;
+    int width;
+    uint64_t min_size;
+    uint64_t max_size;
+    int sparse_percent;
+    int modified_percent;
+    uint64_t seed;
+    char *mirror;
+    char *target;
+} generator_configuration_t;
+
+/*!
+ * @brief next_random is a xorshift64* pseudo random generator, deterministic for a given seed
+ * @param state is a pointer to the generator state (must not be 0)
+ * @return the next random value
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/*!
+ * @brief display_help displays the generator usage
+ * @param my_name is the name of the binary file
+ */
+static void display_help(char *my_name) {
+    printf("%s [options] target_dir\n", my_name);
+    printf("Generates a deterministic tree of files for benchmarks\n");
+    printf("Options: \t-h, --help display help (this text)\n");
+    printf("         \t--files <count> number of files (default 1000)\n");
+    printf("         \t--depth <depth> depth of the directories tree (default 3)\n");
+    printf("         \t--width <count> sub directories per directory (default 4)\n");
+    printf("         \t--min-size <bytes>, --max-size <bytes> files sizes, log-uniformly distributed (default 1K to 1M)\n");
+    printf("         \t--sparse <percent> percentage of sparse files (default 0)\n");
+    printf("         \t--mirror <dir> also generates dir as a synchronized copy of the tree\n");
+    printf("         \t--modified <percent> percentage of files of the tree modified after the mirror was made (default 0)\n");
+    printf("         \t--seed <value> seed of the generator (default 1)\n");
+}
+
+/*!
+ * @brief write_file writes a file of pseudo random content
+ * @param path is the path of the file
+ * @param size is the size of the file
+ * @param content_seed is the seed of the content: the same seed always gives the same content
+ * @param is_sparse makes a file with a hole between its first and last blocks
+ * @param mtime is the modification time of the file
+ * @return 0 in case of success, -1 else
+ */
+static int write_file(char *path, uint64_t size, uint64_t content_seed, bool is_sparse, time_t mtime) {
+    static uint64_t block[GEN_BLOCK_SIZE / sizeof(uint64_t)];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    uint64_t state = content_seed | 1;
+    uint64_t written = 0;
+    while (written < size) {
+        size_t length = (size - written < GEN_BLOCK_SIZE) ? size - written : GEN_BLOCK_SIZE;
+        for (size_t i=0; i<GEN_BLOCK_SIZE / sizeof(uint64_t); ++i) {
+            block[i] = next_random(&state);
+        }
+        // Only the first and last blocks of a sparse file hold data
+        if (is_sparse && written > 0 && size - written > GEN_BLOCK_SIZE) {
+            written = size - GEN_BLOCK_SIZE;
+            continue;
+        }
+        if (pwrite(fd, block, length, written) != (ssize_t) length) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        written += length;
+    }
+    if (ftruncate(fd, size) != 0) {
+        perror(path);
+    }
+
+    struct timespec times[2] = {{.tv_sec = mtime}, {.tv_sec = mtime}};
+    futimens(fd, times);
+    close(fd);
+    return 0;
+}
+
+/*!
+ * @brief make_dirs creates the directories tree and records their paths
+ * @param paths is the array receiving the directories paths
+ * @param count is a pointer to the number of recorded paths
+ * @param path is the path of the directory to create
+ * @param depth is the remaining depth under this directory
+ * @param width is the number of sub directories per directory
+ */
+static void make_dirs(char **paths, size_t *count, char *path, int depth, int width) {
+    mkdir(path, 0755);
+    paths[(*count)++] = strdup(path);
+    if (depth <= 0) {
+        return;
+    }
+    for (int i=0; i<width; ++i) {
+        char name[32];
+        char sub_path[PATH_SIZE];
+        snprintf(name, sizeof(name), "dir-%02d", i);
+        if (concat_path(sub_path, path, name) != NULL) {
+            make_dirs(paths, count, sub_path, depth - 1, width);
+        }
+    }
+}
+
+/*!
+ * @brief generate_tree generates the files of a tree (and of its mirror)
+ * @param the_config is a pointer to the generator configuration
+ * @param root is the root of the tree to generate
+ * @param is_mirror tells if the mirror is generated: modifications are not applied to it
+ * @return 0 in case of success, -1 else
+ */
+static int generate_tree(generator_configuration_t *the_config, char *root, bool is_mirror) {
+    size_t dirs_capacity = 1;
+    for (int i=0, level=1; i<the_config->depth; ++i) {
+        level *= the_config->width;
+        dirs_capacity += level;
+    }
+    char **dirs = malloc(dirs_capacity * sizeof(char *));
+    size_t dirs_count = 0;
+    if (dirs == NULL) {
+        return -1;
+    }
+    make_dirs(dirs, &dirs_count, root, the_config->depth, the_config->width);
+
+    // Same random sequence for the tree and its mirror, so that files have the same names, sizes and contents
+    uint64_t state = the_config->seed | 1;
+    double log_min = log((double) the_config->min_size);
+    double log_max = log((double) the_config->max_size);
+    int result = 0;
+    for (uint64_t i=0; result == 0 && i<the_config->files_count; ++i) {
+        char name[32];
+        char path[PATH_SIZE];
+        size_t dir = next_random(&state) % dirs_count;
+        double ratio = (double) (next_random(&state) >> 11) / (double) (1ULL << 53);
+        uint64_t size = (uint64_t) exp(log_min + ratio * (log_max - log_min));
+        bool is_sparse = (int) (next_random(&state) % 100) < the_config->sparse_percent;
+        bool is_modified = (int) (next_random(&state) % 100) < the_config->modified_percent && !is_mirror;
+        uint64_t content_seed = next_random(&state);
+
+        snprintf(name, sizeof(name), "file-%06lu.dat", (unsigned long) i);
+        if (concat_path(path, dirs[dir], name) == NULL) {
+            continue;
+        }
+        // A modified file keeps its size, but gets another content and a newer mtime
+        result = write_file(path, size, is_modified ? ~content_seed : content_seed, is_sparse, GEN_BASE_MTIME + i + (is_modified ? 1 : 0));
+    }
+
+    for (size_t i=0; i<dirs_count; ++i) {
+        free(dirs[i]);
+    }
+    free(dirs);
+    return result;
+}
+
+/*!
+ * @brief main function of the benchmarks trees generator
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, -1 else
+ */
+int main(int argc, char *argv[]) {
+    generator_configuration_t the_config = {
+        .files_count = 1000,
+        .depth = 3,
+        .width = 4,
+        .min_size = 1024,
+        .max_size = 1024 * 1024,
+        .sparse_percent = 0,
+        .modified_percent = 0,
+        .seed = 1,
+        .mirror = NULL,
+    };
+    struct option my_opts[] = {
+            {.name="files",.has_arg=1,.flag=0,.val='n'},
+            {.name="depth",.has_arg=1,.flag=0,.val='d'},
+            {.name="width",.has_arg=1,.flag=0,.val='w'},
+            {.name="min-size",.has_arg=1,.flag=0,.val='s'},
+            {.name="max-size",.has_arg=1,.flag=0,.val='S'},
+            {.name="sparse",.has_arg=1,.flag=0,.val='p'},
+            {.name="mirror",.has_arg=1,.flag=0,.val='m'},
+            {.name="modified",.has_arg=1,.flag=0,.val='M'},
+            {.name="seed",.has_arg=1,.flag=0,.val='r'},
+            {.name="help",.has_arg=0,.flag=0,.val='h'},
+            {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "h", my_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                the_config.files_count = strtoull(optarg, NULL, 10);
+                break;
+            case 'd':
+                the_config.depth = atoi(optarg);
+                break;
+            case 'w':
+                the_config.width = atoi(optarg);
+                break;
+            case 's':
+                the_config.min_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                the_config.max_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                the_config.sparse_percent = atoi(optarg);
+                break;
+            case 'm':
+                the_config.mirror = optarg;
+                break;
+            case 'M':
+                the_config.modified_percent = atoi(optarg);
+                break;
+            case 'r':
+                the_config.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+                display_help(argv[0]);
+                return 0;
+            default:
+                display_help(argv[0]);
+                return -1;
+        }
+    }
+    if (argc - optind != 1 || the_config.depth < 0 || the_config.width < 1 || the_config.min_size < 1 || the_config.max_size < the_config.min_size) {
+        display_help(argv[0]);
+        return -1;
+    }
+    the_config.target = argv[optind];
+
+    if (the_config.mirror != NULL && generate_tree(&the_config, the_config.mirror, true) != 0) {
+        return -1;
+    }
+    return generate_tree(&the_config, the_config.target, false) == 0 ? 0 : -1;
+}
@@ -0,0 +1,175 @@
+#include <io-order.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+// Set by prepare before the processes are created, so that they all share it
+static io_order_t current_order = IO_ORDER_PATH;
+
+/*!
+ * @brief parse_io_order reads the name of an order (--io-order)
+ * @param name is the name of the order: path, inode or extent
+ * @param order receives the order
+ * @return 0 in case of success, -1 if the name is unknown
+ */
+int parse_io_order(const char *name, io_order_t *order) {
+    static const char *names[] = {"path", "inode", "extent"};
+    for (size_t i=0; i<sizeof(names)/sizeof(names[0]); ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            *order = (io_order_t) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief set_io_order sets the order of the reads of the files
+ * @param order is the order
+ */
+void set_io_order(io_order_t order) {
+    current_order = order;
+}
+
+/*!
+ * @brief get_io_order gives the order of the reads of the files
+ * @return the order
+ */
+io_order_t get_io_order(void) {
+    return current_order;
+}
+
+/*!
+ * @brief first_extent gets the physical position of the first extent of a file
+ * @param path is the path of the file
+ * @param position receives the position, in bytes from the start of the device
+ * @return 0 in case of success, -1 if the file system doesn't tell it or the file has no data
+ */
+static int first_extent(const char *path, uint64_t *position) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {
+        return -1;
+    }
+    // One extent is enough, the request is followed by its room
+    union {
+        struct fiemap request;
+        char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } map;
+    memset(&map, 0, sizeof(map));
+    map.request.fm_start = 0;
+    map.request.fm_length = FIEMAP_MAX_OFFSET;
+    map.request.fm_extent_count = 1;
+    int result = ioctl(fd, FS_IOC_FIEMAP, &map.request);
+    close(fd);
+    if (result != 0 || map.request.fm_mapped_extents == 0 || (map.request.fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN) != 0) {
+        return -1;
+    }
+    *position = map.request.fm_extents[0].fe_physical;
+    return 0;
+}
+
+/*!
+ * @brief set_item_key finds the position of an entry in the order
+ * @param item is a pointer to the item of the entry
+ */
+static void set_item_key(io_order_item_t *item) {
+    item->rank = 0;
+    item->key = 0;
+    if (item->entry->entry_type == DOSSIER || current_order == IO_ORDER_PATH) {
+        return;
+    }
+    struct stat entry_stat;
+    if (current_order == IO_ORDER_EXTENT && first_extent(item->entry->path_and_name, &item->key) == 0) {
+        item->rank = 2;
+    } else if (lstat(item->entry->path_and_name, &entry_stat) == 0) {
+        item->rank = 1;
+        item->key = entry_stat.st_ino;
+    } else {
+        item->rank = 1;
+    }
+}
+
+/*!
+ * @brief compare_items compares two items for qsort, ties are kept in the list order
+ * @param lhd is a pointer to the first item
+ * @param rhd is a pointer to the second item
+ * @return a negative value if lhd comes first, a positive value else
+ */
+static int compare_items(const void *lhd, const void *rhd) {
+    const io_order_item_t *left = lhd;
+    const io_order_item_t *right = rhd;
+    if (left->rank != right->rank) {
+        return (left->rank < right->rank) ? -1 : 1;
+    }
+    if (left->key != right->key) {
+        return (left->key < right->key) ? -1 : 1;
+    }
+    return (left->index < right->index) ? -1 : (left->index > right->index);
+}
+
+/*!
+ * @brief make_io_order gives the order in which the files of a list are read (--io-order)
+ * Directories come first in the list order, so that they are created before their content is copied.
+ * With the path order, the items are in the list order and nothing is read from the disks.
+ * @param list is a pointer to the list
+ * @param count receives the number of items
+ * @return the allocated array of the items (NULL for an empty list or in case of error), to be freed by the caller
+ */
+io_order_item_t *make_io_order(files_list_t *list, size_t *count) {
+    *count = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        ++*count;
+    }
+    if (*count == 0) {
+        return NULL;
+    }
+    io_order_item_t *items = malloc(*count * sizeof(io_order_item_t));
+    if (items == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    uint64_t index = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next, ++index) {
+        items[index].entry = cursor;
+        items[index].index = index;
+        set_item_key(&items[index]);
+    }
+    if (current_order != IO_ORDER_PATH) {
+        qsort(items, *count, sizeof(io_order_item_t), compare_items);
+    }
+    return items;
+}
+
+/*!
+ * @brief sort_list_by_io_order reorders a list in the order its files are read (@see make_io_order)
+ * The list is left unchanged with the path order, or if there is not enough memory.
+ * @param list is a pointer to the list
+ */
+void sort_list_by_io_order(files_list_t *list) {
+    if (current_order == IO_ORDER_PATH) {
+        return;
+    }
+    size_t count;
+    io_order_item_t *items = make_io_order(list, &count);
+    if (items == NULL) {
+        return;
+    }
+    files_list_entry_t *previous = NULL;
+    for (size_t i=0; i<count; ++i) {
+        items[i].entry->prev = previous;
+        items[i].entry->next = NULL;
+        if (previous == NULL) {
+            list->head = items[i].entry;
+        } else {
+            previous->next = items[i].entry;
+        }
+        previous = items[i].entry;
+    }
+    list->tail = previous;
+    free(items);
+}
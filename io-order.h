@@ -0,0 +1,25 @@
+#pragma once
+
+#include <files-list.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Order in which the files are read to be hashed or copied. The lists and the comparison keep the path order.
+typedef enum {
+    IO_ORDER_PATH, // strcmp order of the paths
+    IO_ORDER_INODE, // inode numbers, which most file systems allocate close to the data
+    IO_ORDER_EXTENT // physical position of the first extent of the data (FIEMAP), by inode when it is unknown
+} io_order_t;
+
+typedef struct {
+    files_list_entry_t *entry;
+    uint64_t index; // Position of the entry in its list
+    uint8_t rank; // Directories first, then files without a known position, then files by position
+    uint64_t key;
+} io_order_item_t;
+
+int parse_io_order(const char *name, io_order_t *order);
+void set_io_order(io_order_t order);
+io_order_t get_io_order(void);
+io_order_item_t *make_io_order(files_list_t *list, size_t *count);
+void sort_list_by_io_order(files_list_t *list);
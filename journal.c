@@ -0,0 +1,274 @@
+#define _GNU_SOURCE // syncfs
+#include <journal.h>
+#include <utility.h>
+#include <defines.h>
+#include <file-properties.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// The journal starts with a header (@see write_files_list_header), followed by the differences list
+// (@see write_files_list_entry). Then, each completed operation appends its number.
+// A truncated plan makes the journal unusable, a truncated operation number is cut when the journal is loaded.
+#define JOURNAL_KIND "LP25JNL"
+
+/*!
+ * @brief journal_path builds the path of the journal, in the destination directory
+ * @param result is the buffer receiving the path (PATH_SIZE long)
+ * @param the_config is a pointer to the configuration
+ * @return a pointer to result, NULL in case of error
+ */
+static char *journal_path(char *result, configuration_t *the_config) {
+    return concat_path(result, the_config->destination, JOURNAL_FILE_NAME);
+}
+
+/*!
+ * @brief load_journal loads the journal left by an interrupted synchronization
+ * @param the_config is a pointer to the configuration
+ * @param differences_list is the list receiving the planned operations
+ * @param done_operations receives an array telling for each operation if it was completed (to be freed)
+ * @return 1 if a journal was loaded, 0 if there is none for this source and destination, -1 in case of error
+ */
+int load_journal(configuration_t *the_config, files_list_t *differences_list, uint8_t **done_operations) {
+    char path[PATH_SIZE];
+    if (the_config == NULL || differences_list == NULL || done_operations == NULL || journal_path(path, the_config) == NULL) {
+        return -1;
+    }
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return 0;
+    }
+
+    files_list_header_t header;
+    if (read_files_list_header(stream, JOURNAL_KIND, &header) != 0) {
+        fclose(stream);
+        return 0;
+    }
+    // Journal of another synchronization, or without the digests of this run (--quick-hash): it will be replaced
+    if (strcmp(header.source, the_config->source) != 0 || strcmp(header.destination, the_config->destination) != 0
+        || (header.digests & get_digests()) != get_digests()) {
+        fclose(stream);
+        return 0;
+    }
+    uint64_t count = header.count;
+
+    *done_operations = calloc(count > 0 ? count : 1, sizeof(uint8_t));
+    if (*done_operations == NULL) {
+        fclose(stream);
+        return -1;
+    }
+    files_list_entry_t entry;
+    for (uint64_t i=0; i<count; ++i) {
+        if (read_files_list_entry(stream, &entry) != 0 || add_entry_to_tail(differences_list, &entry) != 0) {
+            // Incomplete plan: the run was interrupted before applying anything
+            clear_files_list(differences_list);
+            free(*done_operations);
+            *done_operations = NULL;
+            fclose(stream);
+            return 0;
+        }
+    }
+
+    uint64_t operation;
+    off_t complete_end = ftello(stream);
+    while (fread(&operation, sizeof(operation), 1, stream) == 1) {
+        if (operation < count) {
+            (*done_operations)[operation] = 1;
+        }
+        complete_end += sizeof(operation);
+    }
+    // An operation number torn by the interruption is cut, so that the resumed run appends aligned numbers
+    fseeko(stream, 0, SEEK_END);
+    bool is_torn = ftello(stream) > complete_end;
+    fclose(stream);
+    if (is_torn && truncate(path, complete_end) != 0) {
+        perror(path);
+        clear_files_list(differences_list);
+        free(*done_operations);
+        *done_operations = NULL;
+        return -1;
+    }
+    return 1;
+}
+
+/*!
+ * @brief open_journal opens the journal of a synchronization
+ * A new journal receives the differences list, which is made durable before any operation is applied.
+ * @param journal is a pointer to the journal to open
+ * @param the_config is a pointer to the configuration
+ * @param differences_list is the list of the planned operations
+ * @param is_resumed tells that the journal was loaded (@see load_journal), it is then appended to
+ * @return 0 in case of success, -1 else
+ */
+int open_journal(journal_t *journal, configuration_t *the_config, files_list_t *differences_list, bool is_resumed) {
+    char path[PATH_SIZE];
+    if (journal == NULL || the_config == NULL || differences_list == NULL || journal_path(path, the_config) == NULL) {
+        return -1;
+    }
+    journal->pending_count = 0;
+    journal->batch_size = (the_config->journal_batch_size > 0) ? the_config->journal_batch_size : 1;
+    journal->pending_operations = malloc(journal->batch_size * sizeof(uint64_t));
+    if (journal->pending_operations == NULL) {
+        return -1;
+    }
+    journal->stream = fopen(path, is_resumed ? "ab" : "wb");
+    if (journal->stream == NULL) {
+        perror(path);
+        free(journal->pending_operations);
+        return -1;
+    }
+    if (is_resumed) {
+        return 0;
+    }
+
+    files_list_header_t header = {.digests = get_digests(), .count = 0};
+    strcpy(header.source, the_config->source);
+    strcpy(header.destination, the_config->destination);
+    for (files_list_entry_t *cursor = differences_list->head; cursor != NULL; cursor = cursor->next) {
+        ++header.count;
+    }
+    int result = write_files_list_header(journal->stream, JOURNAL_KIND, &header);
+    for (files_list_entry_t *cursor = differences_list->head; result == 0 && cursor != NULL; cursor = cursor->next) {
+        result = write_files_list_entry(journal->stream, cursor);
+    }
+    if (result == 0 && (fflush(journal->stream) != 0 || fdatasync(fileno(journal->stream)) != 0)) {
+        result = -1;
+    }
+    if (result != 0) {
+        perror(path);
+        fclose(journal->stream);
+        unlink(path);
+        free(journal->pending_operations);
+    }
+    return result;
+}
+
+/*!
+ * @brief journal_operation_done records a completed operation
+ * Operations are recorded by batches (@see flush_journal)
+ * @param journal is a pointer to the journal
+ * @param operation is the number of the operation (its position in the differences list)
+ * @return 0 in case of success, -1 else
+ */
+int journal_operation_done(journal_t *journal, uint64_t operation) {
+    if (journal == NULL || journal->stream == NULL) {
+        return -1;
+    }
+    journal->pending_operations[journal->pending_count++] = operation;
+    if (journal->pending_count >= journal->batch_size) {
+        return flush_journal(journal);
+    }
+    return 0;
+}
+
+/*!
+ * @brief flush_journal writes the pending completed operations to the journal
+ * The destination filesystem is synced first (one syncfs for the whole batch instead of a fsync per copy), so
+ * that an operation is never recorded before the data it wrote is durable.
+ * @param journal is a pointer to the journal
+ * @return 0 in case of success, -1 else
+ */
+int flush_journal(journal_t *journal) {
+    if (journal == NULL || journal->stream == NULL) {
+        return -1;
+    }
+    if (journal->pending_count == 0) {
+        return 0;
+    }
+    if (syncfs(fileno(journal->stream)) != 0
+        || fwrite(journal->pending_operations, sizeof(uint64_t), journal->pending_count, journal->stream) != journal->pending_count
+        || fflush(journal->stream) != 0 || fdatasync(fileno(journal->stream)) != 0) {
+        return -1;
+    }
+    journal->pending_count = 0;
+    return 0;
+}
+
+/*!
+ * @brief close_journal closes the journal at the end of a synchronization and removes it
+ * The run was not interrupted, so the next run will list the trees again: failed operations are retried then.
+ * @param journal is a pointer to the journal
+ * @param the_config is a pointer to the configuration
+ */
+void close_journal(journal_t *journal, configuration_t *the_config) {
+    char path[PATH_SIZE];
+    if (journal == NULL || journal->stream == NULL) {
+        return;
+    }
+    // The copies must be durable before the journal disappears
+    syncfs(fileno(journal->stream));
+    fclose(journal->stream);
+    journal->stream = NULL;
+    free(journal->pending_operations);
+    journal->pending_operations = NULL;
+    if (journal_path(path, the_config) != NULL) {
+        unlink(path);
+    }
+}
+
+/*!
+ * @brief revalidate_journal updates the pending operations of a loaded journal with the current source entries
+ * Source files changed since the interruption are analyzed again, so that they are copied with their current
+ * properties. Removed source entries are marked as done, there is nothing left to copy for them.
+ * Operations keep their number, since the journal records them by position.
+ * @param differences_list is the list loaded from the journal
+ * @param done_operations tells for each operation if it was already done, updated with the skipped operations
+ * @param is_verbose tells if the changed entries are displayed
+ * @return the number of updated or skipped entries
+ */
+int revalidate_journal(files_list_t *differences_list, uint8_t *done_operations, bool is_verbose) {
+    int changed = 0;
+    uint64_t operation = 0;
+    for (files_list_entry_t *cursor = differences_list->head; cursor != NULL; cursor = cursor->next, ++operation) {
+        if (done_operations[operation]) {
+            continue;
+        }
+        struct stat file_stat;
+        if (stat(cursor->path_and_name, &file_stat) != 0 || (cursor->entry_type == DOSSIER) != S_ISDIR(file_stat.st_mode)) {
+            if (is_verbose) {
+                printf("%s changed type or was removed since the interruption, skipped\n", cursor->path_and_name);
+            }
+            done_operations[operation] = 1;
+            ++changed;
+            continue;
+        }
+        if (file_stat.st_mode == cursor->mode && (cursor->entry_type == DOSSIER || ((uint64_t) file_stat.st_size == cursor->size
+            && file_stat.st_mtim.tv_sec == cursor->mtime.tv_sec && file_stat.st_mtim.tv_nsec == cursor->mtime.tv_nsec))) {
+            continue;
+        }
+        if (is_verbose) {
+            printf("%s changed since the interruption, analyzed again\n", cursor->path_and_name);
+        }
+        if (get_file_stats(cursor) != 0) {
+            done_operations[operation] = 1;
+        }
+        ++changed;
+    }
+    return changed;
+}
+
+/*!
+ * @brief remove_temporary_files removes the temporary files left by copies interrupted with the synchronization
+ * @param directory is the destination directory, searched recursively
+ */
+void remove_temporary_files(char *directory) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_SIZE];
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || concat_path(path, directory, entry->d_name) == NULL) {
+            continue;
+        }
+        if (strncmp(entry->d_name, TEMPORARY_FILE_PREFIX, strlen(TEMPORARY_FILE_PREFIX)) == 0) {
+            unlink(path);
+        } else if (entry->d_type == DT_DIR) {
+            remove_temporary_files(path);
+        }
+    }
+    closedir(dir);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+    FILE *stream;
+    uint64_t *pending_operations; // Completed operations not written yet
+    uint32_t pending_count;
+    uint32_t batch_size;
+} journal_t;
+
+int load_journal(configuration_t *the_config, files_list_t *differences_list, uint8_t **done_operations);
+int open_journal(journal_t *journal, configuration_t *the_config, files_list_t *differences_list, bool is_resumed);
+int journal_operation_done(journal_t *journal, uint64_t operation);
+int flush_journal(journal_t *journal);
+void close_journal(journal_t *journal, configuration_t *the_config);
+int revalidate_journal(files_list_t *differences_list, uint8_t *done_operations, bool is_verbose);
+void remove_temporary_files(char *directory);
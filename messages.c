@@ -1,9 +1,61 @@
 #include <messages.h>
+#include <stats.h>
 #include <sys/msg.h>
 #include <string.h>
+#include <stddef.h>
+#include <errno.h>
 
 // Functions in this file are required for inter processes communication
 
+/*!
+ * @brief send_message sends a message, retrying when interrupted by a signal
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message (starting with its mtype)
+ * @param size is the size of the message, including its mtype
+ * @return the result of the msgsnd function
+ */
+static int send_message(int msg_queue, void *message, size_t size) {
+    int result;
+    do {
+        result = msgsnd(msg_queue, message, size - sizeof(long), 0);
+    } while (result == -1 && errno == EINTR);
+    if (result == 0) {
+        stats_add(STAT_MQ_MESSAGES_SENT, 1);
+        stats_add(STAT_MQ_BYTES_SENT, size);
+    }
+    return result;
+}
+
+/*!
+ * @brief entry_size gives the size of the used part of an entry
+ * @param file_entry is a pointer to the entry
+ * @return the size of the entry up to the end of its path (including its terminating '\0')
+ */
+static size_t entry_size(files_list_entry_t *file_entry) {
+    return offsetof(files_list_entry_t, path_and_name) + strlen(file_entry->path_and_name) + 1;
+}
+
+/*!
+ * @brief receive_message waits for a message, retrying when interrupted by a signal
+ * @param msg_queue the MQ identifier from which to receive the message
+ * @param message is a pointer to the buffer receiving the message
+ * @param recipient is the mtype of the messages to receive
+ * @return the result of the msgrcv function
+ */
+ssize_t receive_message(int msg_queue, any_message_t *message, long recipient) {
+    ssize_t result;
+    uint64_t start = stats_clock();
+    do {
+        result = msgrcv(msg_queue, message, sizeof(any_message_t) - sizeof(long), recipient, 0);
+    } while (result == -1 && errno == EINTR);
+    if (result >= 0) {
+        stats_add_time(STAT_IPC_WAIT_NS, start);
+        stats_add(STAT_MQ_MESSAGES_RECEIVED, 1);
+        stats_add(STAT_MQ_BYTES_RECEIVED, result + sizeof(long));
+    }
+    return result;
+}
+
 /*!
  * @brief send_file_entry sends a file entry, with a given command code
  * @param msg_queue the MQ identifier through which to send the entry
@@ -14,6 +66,11 @@
  * Used by the specialized functions send_analyze*
  */
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
+    analyze_file_command_t message;
+    message.mtype = recipient;
+    message.op_code = cmd_code;
+    memcpy(&message.payload, file_entry, entry_size(file_entry));
+    return send_message(msg_queue, &message, offsetof(analyze_file_command_t, payload) + entry_size(file_entry));
 }
 
 /*!
@@ -24,6 +81,15 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
  * @return the result of msgsnd
  */
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
+    analyze_dir_command_t message;
+    size_t length = strlen(target_dir);
+    if (length >= sizeof(message.target)) {
+        return -1;
+    }
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_ANALYZE_DIR;
+    memcpy(message.target, target_dir, length + 1);
+    return send_message(msg_queue, &message, offsetof(analyze_dir_command_t, target) + length + 1);
 }
 
 // The 3 following functions are one-liners
@@ -37,6 +103,7 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
  * Calls send_file_entry function
  */
 int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_ANALYZE_FILE);
 }
 
 /*!
@@ -44,21 +111,90 @@ int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
  * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param is_readable is false if the entry could not be analyzed (e.g. removed since it was listed), so that it is skipped
  * @return the result of the send_file_entry function
  * Calls send_file_entry function
  */
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, bool is_readable) {
+    return send_file_entry(msg_queue, recipient, file_entry, is_readable ? COMMAND_CODE_FILE_ANALYZED : COMMAND_CODE_FILE_UNREADABLE);
 }
 
 /*!
- * @brief send_files_list_element sends a files list entry from a complete files list
+ * @brief send_analyze_stream_file_command sends a file entry to be analyzed for the main process
+ * The analyzer sends the analyzed entry to the main process instead of its lister (@see synchronize_bounded)
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
  * @param file_entry is a pointer to the entry to send (must be copied)
  * @return the result of the send_file_entry function
- * Calls send_file_entry function
  */
-int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+int send_analyze_stream_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_ANALYZE_STREAM_FILE);
+}
+
+/*!
+ * @brief send_verify_file_command sends a copied file to be read again from the destination and checked
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the source entry of the copy, with its MD5 sum unless the lists have none (--quick-hash)
+ * @return the result of the send_file_entry function
+ */
+int send_verify_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_VERIFY_FILE);
+}
+
+/*!
+ * @brief send_verify_file_response sends the result of a verification
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the verified entry
+ * @param matches is true if the destination file has the expected MD5 sum
+ * @return the result of the send_file_entry function
+ */
+int send_verify_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, bool matches) {
+    return send_file_entry(msg_queue, recipient, file_entry, matches ? COMMAND_CODE_FILE_VERIFIED : COMMAND_CODE_FILE_CORRUPTED);
+}
+
+/*!
+ * @brief send_list_entry sends a files list entry with the id of its sender, with a given command code
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param reply_to is the id of the sender, so that the recipient knows to which list the entry belongs
+ * @param cmd_code is the cmd code to process the entry
+ * @return the result of the msgsnd function
+ */
+static int send_list_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int reply_to, int cmd_code) {
+    files_list_entry_transmit_t message;
+    message.mtype = recipient;
+    message.op_code = cmd_code;
+    message.reply_to = reply_to;
+    memcpy(&message.payload, file_entry, entry_size(file_entry));
+    return send_message(msg_queue, &message, offsetof(files_list_entry_transmit_t, payload) + entry_size(file_entry));
+}
+
+/*!
+ * @brief send_files_list_element sends a files list entry from a complete files list
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param reply_to is the id of the sender, so that the recipient knows to which list the entry belongs
+ * @return the result of the msgsnd function
+ */
+int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry, int reply_to) {
+    return send_list_entry(msg_queue, recipient, file_entry, reply_to, COMMAND_CODE_FILE_ENTRY);
+}
+
+/*!
+ * @brief send_stream_file_response sends an entry analyzed for the main process (@see send_analyze_stream_file_command)
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param reply_to is the id of the analyzers, so that the recipient knows to which tree the entry belongs
+ * @param is_readable is false if the entry could not be analyzed, so that it is skipped
+ * @return the result of the msgsnd function
+ */
+int send_stream_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, int reply_to, bool is_readable) {
+    return send_list_entry(msg_queue, recipient, file_entry, reply_to, is_readable ? COMMAND_CODE_FILE_ENTRY : COMMAND_CODE_FILE_UNREADABLE);
 }
 
 /*!
@@ -68,6 +204,8 @@ int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *fi
  * @return the result of msgsnd
  */
 int send_list_end(int msg_queue, int recipient) {
+    simple_command_t message = {.mtype = recipient, .message = COMMAND_CODE_LIST_COMPLETE};
+    return send_message(msg_queue, &message, sizeof(message));
 }
 
 /*!
@@ -77,6 +215,8 @@ int send_list_end(int msg_queue, int recipient) {
  * @return the result of msgsnd
  */
 int send_terminate_command(int msg_queue, int recipient) {
+    simple_command_t message = {.mtype = recipient, .message = COMMAND_CODE_TERMINATE};
+    return send_message(msg_queue, &message, sizeof(message));
 }
 
 /*!
@@ -86,4 +226,6 @@ int send_terminate_command(int msg_queue, int recipient) {
  * @return the result of msgsnd
  */
 int send_terminate_confirm(int msg_queue, int recipient) {
+    simple_command_t message = {.mtype = recipient, .message = COMMAND_CODE_TERMINATE_OK};
+    return send_message(msg_queue, &message, sizeof(message));
 }
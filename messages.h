@@ -2,14 +2,21 @@
 
 #include <files-list.h>
 #include <defines.h>
+#include <sys/types.h>
+#include <stdbool.h>
 
 #define COMMAND_CODE_TERMINATE 0x0
 #define COMMAND_CODE_TERMINATE_OK 0x10
 #define COMMAND_CODE_ANALYZE_FILE 0x01
 #define COMMAND_CODE_FILE_ANALYZED 0x11
+#define COMMAND_CODE_FILE_UNREADABLE 0x21
 #define COMMAND_CODE_ANALYZE_DIR 0x02
 #define COMMAND_CODE_FILE_ENTRY 0x12
 #define COMMAND_CODE_LIST_COMPLETE 0x22
+#define COMMAND_CODE_VERIFY_FILE 0x03
+#define COMMAND_CODE_ANALYZE_STREAM_FILE 0x04
+#define COMMAND_CODE_FILE_VERIFIED 0x13
+#define COMMAND_CODE_FILE_CORRUPTED 0x23
 
 #define MSG_TYPE_TO_MAIN 1
 #define MSG_TYPE_TO_SOURCE_LISTER 2
@@ -28,11 +35,12 @@ typedef struct {
     files_list_entry_t payload;
 } analyze_file_command_t;
 
+// reply_to is before the payload, whose path is truncated to its length when sent
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze file opcode
-    files_list_entry_t payload;
     int reply_to; // MQ id of the sender, to build either source or destination list
+    files_list_entry_t payload;
 } files_list_entry_transmit_t;
 
 typedef struct {
@@ -51,8 +59,13 @@ typedef union {
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
 int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry);
-int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, bool is_readable);
+int send_analyze_stream_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_verify_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_verify_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, bool matches);
+int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry, int reply_to);
+int send_stream_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry, int reply_to, bool is_readable);
 int send_list_end(int msg_queue, int recipient);
 int send_terminate_command(int msg_queue, int recipient);
-int send_terminate_confirm(int msg_queue, int recipient);
\ No newline at end of file
+int send_terminate_confirm(int msg_queue, int recipient);
+ssize_t receive_message(int msg_queue, any_message_t *message, long recipient);
\ No newline at end of file
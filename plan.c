@@ -0,0 +1,171 @@
+#include <plan.h>
+#include <defines.h>
+#include <file-properties.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// A plan is a header (@see write_files_list_header) followed by the differences list, with the source metadata of
+// each entry (@see write_files_list_entry). Then come the entries of the destination contents index (their count,
+// then each entry followed by its orphan flag), so that applying the plan renames and links as the run computing it.
+#define PLAN_KIND "LP25PLN"
+
+/*!
+ * @brief is_changed tells if an entry changed since it was listed
+ * Only the size and mtime of files are checked (a stat each), they are not hashed again.
+ * @param entry is the entry
+ * @return true if the entry changed or was removed
+ */
+static bool is_changed(files_list_entry_t *entry) {
+    struct stat file_stat;
+    if (stat(entry->path_and_name, &file_stat) != 0) {
+        return true;
+    }
+    if (entry->entry_type == DOSSIER) {
+        return !S_ISDIR(file_stat.st_mode);
+    }
+    return !S_ISREG(file_stat.st_mode) || (uint64_t) file_stat.st_size != entry->size
+           || file_stat.st_mtim.tv_sec != entry->mtime.tv_sec || file_stat.st_mtim.tv_nsec != entry->mtime.tv_nsec;
+}
+
+/*!
+ * @brief write_plan saves a differences list so that it can be applied later (@see read_plan)
+ * @param path is the path of the plan file
+ * @param the_config is a pointer to the configuration
+ * @param differences_list is the list to save
+ * @param destination_index is the index of the destination contents, NULL if none
+ * @return 0 in case of success, -1 else
+ */
+int write_plan(char *path, configuration_t *the_config, files_list_t *differences_list, digest_index_t *destination_index) {
+    if (path == NULL || the_config == NULL || differences_list == NULL) {
+        return -1;
+    }
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    files_list_header_t header = {.digests = get_digests(), .count = 0};
+    strcpy(header.source, the_config->source);
+    strcpy(header.destination, the_config->destination);
+    for (files_list_entry_t *cursor = differences_list->head; cursor != NULL; cursor = cursor->next) {
+        ++header.count;
+    }
+    int result = write_files_list_header(stream, PLAN_KIND, &header);
+    for (files_list_entry_t *cursor = differences_list->head; result == 0 && cursor != NULL; cursor = cursor->next) {
+        result = write_files_list_entry(stream, cursor);
+    }
+    uint64_t index_count = (destination_index != NULL) ? destination_index->count : 0;
+    if (result == 0 && fwrite(&index_count, sizeof(index_count), 1, stream) != 1) {
+        result = -1;
+    }
+    for (size_t i=0; result == 0 && index_count > 0 && i<destination_index->buckets_count; ++i) {
+        for (digest_index_node_t *node = destination_index->buckets[i]; result == 0 && node != NULL; node = node->next) {
+            uint8_t is_orphan = node->is_orphan;
+            if (write_files_list_entry(stream, node->entry) != 0 || fwrite(&is_orphan, sizeof(is_orphan), 1, stream) != 1) {
+                result = -1;
+            }
+        }
+    }
+    if (fclose(stream) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        perror(path);
+        remove(path);
+    }
+    return result;
+}
+
+/*!
+ * @brief read_plan loads a plan saved by write_plan
+ * The plan must have been computed for the same source and destination as the configuration, with the digests of
+ * this run. The destination entries of the plan that changed since it was computed are not indexed.
+ * @param path is the path of the plan file
+ * @param the_config is a pointer to the configuration
+ * @param differences_list is the list receiving the entries of the plan
+ * @param destination_list is the list receiving the indexed destination entries
+ * @param destination_index is the index receiving the destination entries, NULL to ignore them
+ * @return 0 in case of success, -1 else
+ */
+int read_plan(char *path, configuration_t *the_config, files_list_t *differences_list, files_list_t *destination_list, digest_index_t *destination_index) {
+    if (path == NULL || the_config == NULL || differences_list == NULL) {
+        return -1;
+    }
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    files_list_header_t header;
+    if (read_files_list_header(stream, PLAN_KIND, &header) != 0) {
+        fprintf(stderr, "%s is not a valid plan\n", path);
+        fclose(stream);
+        return -1;
+    }
+    if (strcmp(header.source, the_config->source) != 0 || strcmp(header.destination, the_config->destination) != 0) {
+        fprintf(stderr, "%s was computed to synchronize %s into %s\n", path, header.source, header.destination);
+        fclose(stream);
+        return -1;
+    }
+    if ((header.digests & get_digests()) != get_digests()) {
+        fprintf(stderr, "%s was computed with other digests, apply it with the same --quick-hash option\n", path);
+        fclose(stream);
+        return -1;
+    }
+
+    files_list_entry_t entry;
+    for (uint64_t i=0; i<header.count; ++i) {
+        if (read_files_list_entry(stream, &entry) != 0 || add_entry_to_tail(differences_list, &entry) != 0) {
+            fprintf(stderr, "%s is truncated\n", path);
+            clear_files_list(differences_list);
+            fclose(stream);
+            return -1;
+        }
+    }
+
+    uint64_t index_count;
+    if (fread(&index_count, sizeof(index_count), 1, stream) != 1) {
+        index_count = 0;
+    }
+    for (uint64_t i=0; destination_index != NULL && i<index_count; ++i) {
+        uint8_t is_orphan;
+        if (read_files_list_entry(stream, &entry) != 0 || fread(&is_orphan, sizeof(is_orphan), 1, stream) != 1) {
+            // Without the index, the plan is still applied, with copies
+            fprintf(stderr, "%s is truncated, some files will be copied instead of renamed or linked\n", path);
+            break;
+        }
+        if (!is_changed(&entry) && add_entry_to_tail(destination_list, &entry) == 0) {
+            add_to_digest_index(destination_index, destination_list->tail, is_orphan != 0);
+        }
+    }
+    fclose(stream);
+    return 0;
+}
+
+/*!
+ * @brief revalidate_plan removes from a loaded plan the source entries that changed since it was computed
+ * A changed file will be synchronized by the next complete run (@see is_changed).
+ * @param differences_list is the list loaded from the plan
+ * @param is_verbose tells if the removed entries are displayed
+ * @return the number of removed entries
+ */
+int revalidate_plan(files_list_t *differences_list, bool is_verbose) {
+    int removed = 0;
+    files_list_entry_t *cursor = differences_list->head;
+    while (cursor != NULL) {
+        files_list_entry_t *next = cursor->next;
+        if (is_changed(cursor)) {
+            if (is_verbose) {
+                printf("%s changed since the plan was computed, skipped\n", cursor->path_and_name);
+            }
+            remove_entry_from_list(differences_list, cursor);
+            ++removed;
+        }
+        cursor = next;
+    }
+    return removed;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <digest-index.h>
+
+int write_plan(char *path, configuration_t *the_config, files_list_t *differences_list, digest_index_t *destination_index);
+int read_plan(char *path, configuration_t *the_config, files_list_t *differences_list, files_list_t *destination_list, digest_index_t *destination_index);
+int revalidate_plan(files_list_t *differences_list, bool is_verbose);
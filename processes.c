@@ -2,20 +2,171 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <messages.h>
 #include <file-properties.h>
 #include <sync.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <cache-policy.h>
+#include <tuning.h>
+#include <dir-cache.h>
+#include <io-order.h>
+#include <utility.h>
+
+// Storage of the statistics and limits when they can't be shared, used by the main process alone
+static shared_segment_t local_segment;
+
+/*!
+ * @brief prepare_shared_segment sets up the memory shared by the main process and its children
+ * The segment is marked for removal as soon as it is attached: it is released when the last process detaches it,
+ * even if the program is killed.
+ * @param p_context is a pointer to the program processes context
+ * @return 0 if all went good, -1 else
+ */
+static int prepare_shared_segment(process_context_t *p_context) {
+    p_context->shared_segment_id = shmget(IPC_PRIVATE, sizeof(shared_segment_t), IPC_CREAT | 0600);
+    if (p_context->shared_segment_id == -1) {
+        perror("shmget");
+        return -1;
+    }
+    p_context->shared_segment = shmat(p_context->shared_segment_id, NULL, 0);
+    shmctl(p_context->shared_segment_id, IPC_RMID, NULL);
+    if (p_context->shared_segment == (void *) -1) {
+        perror("shmat");
+        p_context->shared_segment = NULL;
+        return -1;
+    }
+    memset(p_context->shared_segment, 0, sizeof(shared_segment_t));
+    return 0;
+}
 
 /*!
- * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
+ * @brief prepare prepares the processes used for the synchronization (only when parallel is enabled).
+ * It also sets up the memory shared with the processes when a feature needs it (statistics, limits), and the cache
+ * policy, the filter, the I/O order and the digests inherited by the processes.
+ * With -n auto, the number of analyzers of each side is chosen from the processors and the storages of both
+ * directories (@see choose_analyzers_counts).
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the program processes context
  * @return 0 if all went good, -1 else
  */
 int prepare(configuration_t *the_config, process_context_t *p_context) {
+    memset(p_context, 0, sizeof(process_context_t));
+    p_context->main_process_pid = getpid();
+    p_context->message_queue_id = -1;
+    p_context->shared_segment_id = -1;
+    p_context->processes_count = (the_config->processes_count > 0) ? the_config->processes_count : 1;
+    p_context->source_analyzers_count = p_context->processes_count;
+    p_context->destination_analyzers_count = p_context->processes_count;
+    if (the_config->is_auto_tuned) {
+        choose_analyzers_counts(the_config->source, the_config->destination, &p_context->source_analyzers_count, &p_context->destination_analyzers_count);
+        if (the_config->is_verbose) {
+            printf("Analyzers: %d for the source, %d for the destination\n", p_context->source_analyzers_count, p_context->destination_analyzers_count);
+        }
+    }
+    set_cache_friendly(the_config->is_cache_friendly);
+    use_filter(&the_config->filter);
+    set_io_order(the_config->io_order);
+    if (the_config->uses_dir_cache && load_dir_cache(the_config) != 0) {
+        fprintf(stderr, "Directory cache could not be loaded, everything is listed and hashed\n");
+    }
+    // The full scans of the directory cache are the scheduled full hash passes of --quick-hash, else they are counted
+    // on their own
+    if (the_config->uses_quick_hash) {
+        bool is_full_pass = the_config->uses_dir_cache ? is_dir_cache_full_scan() : load_quick_hash_runs(the_config);
+        set_digests(is_full_pass ? DIGEST_MD5 | DIGEST_FINGERPRINT : DIGEST_FINGERPRINT);
+        if (the_config->is_verbose && is_full_pass) {
+            printf("Full hash pass\n");
+        }
+    }
+    // --date-size-only compares the dates and sizes only, so the listers and analyzers hash nothing
+    if (!the_config->uses_md5) {
+        set_digests(0);
+    }
+
+    throttle_set_rate(THROTTLE_READ_BYTES, the_config->read_limit);
+    throttle_set_rate(THROTTLE_WRITE_BYTES, the_config->write_limit);
+    throttle_set_rate(THROTTLE_FILES, the_config->files_limit);
+    if (the_config->limits_path[0] != '\0' && throttle_watch_limits(the_config->limits_path) != 0) {
+        fprintf(stderr, "Limits file %s could not be loaded\n", the_config->limits_path);
+    }
+
+    // Limits can be changed during the run with a limits file, so they are shared as soon as there is one
+    // Without the segment, the children would neither count nor share the limits: the main process works alone
+    int result = 0;
+    if (the_config->prints_stats || is_throttled() || the_config->limits_path[0] != '\0') {
+        if (prepare_shared_segment(p_context) != 0) {
+            fprintf(stderr, "Statistics and limits can't be shared with other processes, parallelism is disabled\n");
+            memset(&local_segment, 0, sizeof(shared_segment_t));
+            p_context->shared_segment = &local_segment;
+            the_config->is_parallel = false;
+            result = -1;
+        }
+        if (the_config->prints_stats) {
+            stats_attach(&p_context->shared_segment->stats);
+        }
+        throttle_attach(&p_context->shared_segment->throttle);
+    }
+
+    if (!the_config->is_parallel) {
+        return result;
+    }
+
+    p_context->shared_key = IPC_PRIVATE;
+    p_context->message_queue_id = msgget(p_context->shared_key, IPC_CREAT | 0600);
+    if (p_context->message_queue_id == -1) {
+        perror("msgget");
+        the_config->is_parallel = false;
+        return -1;
+    }
+    p_context->source_analyzers_pids = calloc(p_context->source_analyzers_count, sizeof(pid_t));
+    p_context->destination_analyzers_pids = calloc(p_context->destination_analyzers_count, sizeof(pid_t));
+    if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
+        clean_processes(the_config, p_context);
+        the_config->is_parallel = false;
+        return -1;
+    }
+
+    // Children get a copy of the parameters when forked, so local variables can be used
+    lister_configuration_t source_lister = {
+        .my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS,
+        .my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER,
+        .analyzers_count = p_context->source_analyzers_count,
+        .mq_key = p_context->shared_key,
+        .mq_id = p_context->message_queue_id,
+        .adapts_window = the_config->is_auto_tuned,
+    };
+    lister_configuration_t destination_lister = source_lister;
+    destination_lister.my_recipient_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
+    destination_lister.my_receiver_id = MSG_TYPE_TO_DESTINATION_LISTER;
+    destination_lister.analyzers_count = p_context->destination_analyzers_count;
+
+    analyzer_configuration_t source_analyzer = {
+        .my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER,
+        .my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS,
+        .mq_key = p_context->shared_key,
+        .mq_id = p_context->message_queue_id,
+        .source = the_config->source,
+        .destination = the_config->destination,
+    };
+    analyzer_configuration_t destination_analyzer = source_analyzer;
+    destination_analyzer.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
+    destination_analyzer.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
+
+    p_context->source_lister_pid = make_process(p_context, lister_process_loop, &source_lister);
+    p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &destination_lister);
+    for (int i=0; i<p_context->source_analyzers_count; ++i) {
+        p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &source_analyzer);
+    }
+    for (int i=0; i<p_context->destination_analyzers_count; ++i) {
+        p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &destination_analyzer);
+    }
+    return 0;
 }
 
 /*!
@@ -26,6 +177,71 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
  * @return the PID of the child process (it never returns in the child process)
  */
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters) {
+    // Buffered outputs would be written by both processes
+    fflush(stdout);
+    fflush(stderr);
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The main process drives the shutdown (see clean_processes): an interactive Ctrl-C must not
+        // kill the children behind its back, but they must not outlive it either.
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) {
+            exit(0);
+        }
+        func(parameters);
+        exit(0);
+    }
+    if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+/*!
+ * @brief analyze_list has all the entries of a list analyzed, keeping up to analyzers_count requests in flight
+ * When the lister adapts its window, fewer requests may be kept in flight if it gives a better throughput, e.g. on a
+ * disk slowed down by concurrent reads (@see window_tuner_record).
+ * @param msg_queue is the id of the MQ
+ * @param cfg is a pointer to the lister configuration
+ * @param list is the list of the entries to analyze (paths and types only)
+ * @param analyzed_list receives the analyzed entries, in the order of the responses
+ */
+static void analyze_list(int msg_queue, lister_configuration_t *cfg, files_list_t *list, files_list_t *analyzed_list) {
+    int current_analyzers = 0;
+    files_list_entry_t *next_entry = list->head;
+    any_message_t message;
+    window_tuner_t tuner;
+    init_window_tuner(&tuner, cfg->analyzers_count);
+    int window = tuner.window;
+
+    while (next_entry != NULL && current_analyzers < window) {
+        request_element_details(msg_queue, next_entry, cfg, &current_analyzers);
+        next_entry = next_entry->next;
+    }
+    while (current_analyzers > 0) {
+        if (receive_message(msg_queue, &message, cfg->my_receiver_id) < 0) {
+            perror("msgrcv");
+            return;
+        }
+        if (message.analyze_file_command.op_code != COMMAND_CODE_FILE_ANALYZED && message.analyze_file_command.op_code != COMMAND_CODE_FILE_UNREADABLE) {
+            continue;
+        }
+        --current_analyzers;
+        if (message.analyze_file_command.op_code == COMMAND_CODE_FILE_ANALYZED) {
+            add_entry_to_tail(analyzed_list, &message.analyze_file_command.payload);
+        }
+        if (cfg->adapts_window) {
+            // Each file costs at least a block read, even when empty
+            window = window_tuner_record(&tuner, message.analyze_file_command.payload.size + 4096);
+        }
+        while (next_entry != NULL && current_analyzers < window) {
+            request_element_details(msg_queue, next_entry, cfg, &current_analyzers);
+            next_entry = next_entry->next;
+        }
+    }
 }
 
 /*!
@@ -33,6 +249,39 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
  * @param parameters is a pointer to its parameters, to be cast to a lister_configuration_t
  */
 void lister_process_loop(void *parameters) {
+    lister_configuration_t *cfg = (lister_configuration_t *) parameters;
+    any_message_t message;
+    bool is_running = true;
+
+    while (is_running) {
+        if (receive_message(cfg->mq_id, &message, cfg->my_receiver_id) < 0) {
+            perror("msgrcv");
+            return;
+        }
+        switch (message.simple_command.message) {
+            case COMMAND_CODE_ANALYZE_DIR: {
+                files_list_t list = {NULL, NULL};
+                files_list_t analyzed_list = {NULL, NULL};
+                make_list(&list, message.analyze_dir_command.target);
+                // Requests are sent in the order of the data on the disk (--io-order)
+                sort_list_by_io_order(&list);
+                analyze_list(cfg->mq_id, cfg, &list, &analyzed_list);
+                // Responses come in any order
+                sort_files_list(&analyzed_list);
+                for (files_list_entry_t *cursor = analyzed_list.head; cursor != NULL; cursor = cursor->next) {
+                    send_files_list_element(cfg->mq_id, MSG_TYPE_TO_MAIN, cursor, cfg->my_receiver_id);
+                }
+                send_list_end(cfg->mq_id, MSG_TYPE_TO_MAIN);
+                clear_files_list(&list);
+                clear_files_list(&analyzed_list);
+                break;
+            }
+            case COMMAND_CODE_TERMINATE:
+                send_terminate_confirm(cfg->mq_id, MSG_TYPE_TO_MAIN);
+                is_running = false;
+                break;
+        }
+    }
 }
 
 /*!
@@ -40,17 +289,136 @@ void lister_process_loop(void *parameters) {
  * @param parameters is a pointer to its parameters, to be cast to an analyzer_configuration_t
  */
 void analyzer_process_loop(void *parameters) {
+    analyzer_configuration_t *cfg = (analyzer_configuration_t *) parameters;
+    any_message_t message;
+    bool is_running = true;
+    uint64_t idle_start = stats_clock();
+
+    while (is_running) {
+        if (receive_message(cfg->mq_id, &message, cfg->my_receiver_id) < 0) {
+            perror("msgrcv");
+            return;
+        }
+        stats_add_time(STAT_ANALYZER_IDLE_NS, idle_start);
+        uint64_t busy_start = stats_clock();
+        switch (message.simple_command.message) {
+            case COMMAND_CODE_ANALYZE_FILE: {
+                // An entry removed or unreadable since it was listed is skipped instead of looking like an empty file
+                bool is_readable = get_file_stats(&message.analyze_file_command.payload) == 0;
+                send_analyze_file_response(cfg->mq_id, cfg->my_recipient_id, &message.analyze_file_command.payload, is_readable);
+                break;
+            }
+            case COMMAND_CODE_ANALYZE_STREAM_FILE: {
+                // reply_to tells the main process which side the entry belongs to
+                bool is_readable = get_file_stats(&message.analyze_file_command.payload) == 0;
+                send_stream_file_response(cfg->mq_id, MSG_TYPE_TO_MAIN, &message.analyze_file_command.payload, cfg->my_receiver_id, is_readable);
+                break;
+            }
+            case COMMAND_CODE_VERIFY_FILE: {
+                // Verifications are requested by the main process after the copies (--verify), with the source entry.
+                // Without MD5 sums in the lists (--quick-hash), the source is hashed here as well.
+                unsigned char md5sum[sizeof(message.analyze_file_command.payload.md5sum)];
+                char destination_path[PATH_SIZE];
+                files_list_entry_t *entry = &message.analyze_file_command.payload;
+                bool matches = true; // A source that can't be read again isn't verified (@see verify_copy)
+                if (((get_digests() & DIGEST_MD5) != 0 || compute_file_md5(entry) == 0)
+                    && concat_path(destination_path, cfg->destination, relative_path(entry->path_and_name, cfg->source)) != NULL) {
+                    matches = compute_file_md5_uncached(destination_path, md5sum) == 0 && memcmp(md5sum, entry->md5sum, sizeof(md5sum)) == 0;
+                }
+                send_verify_file_response(cfg->mq_id, MSG_TYPE_TO_MAIN, entry, matches);
+                break;
+            }
+            case COMMAND_CODE_TERMINATE:
+                send_terminate_confirm(cfg->mq_id, MSG_TYPE_TO_MAIN);
+                is_running = false;
+                break;
+        }
+        stats_add_time(STAT_ANALYZER_BUSY_NS, busy_start);
+        idle_start = stats_clock();
+    }
 }
 
 /*!
  * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
+ * The statistics are copied out of the shared segment before it is released, and printed when requested (--stats).
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the processes context
  */
 void clean_processes(configuration_t *the_config, process_context_t *p_context) {
     // Do nothing if not parallel
-    // Send terminate
-    // Wait for responses
-    // Free allocated memory
-    // Free the MQ
+    if (the_config->is_parallel && p_context->message_queue_id != -1) {
+        int children_count = 0;
+        any_message_t message;
+
+        // Send terminate
+        if (p_context->source_analyzers_pids != NULL && p_context->destination_analyzers_pids != NULL) {
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_LISTER);
+            send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_LISTER);
+            children_count += 2;
+            for (int i=0; i<p_context->source_analyzers_count; ++i) {
+                send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_ANALYZERS);
+                ++children_count;
+            }
+            for (int i=0; i<p_context->destination_analyzers_count; ++i) {
+                send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS);
+                ++children_count;
+            }
+        }
+
+        // Wait for the children to exit, draining the queue meanwhile so that none of them blocks on a full
+        // queue. A child which died without confirming must not wedge the main process, so nothing blocks here.
+        while (children_count > 0) {
+            bool progress = false;
+            while (msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, IPC_NOWAIT) >= 0) {
+                progress = true;
+            }
+            pid_t pid;
+            while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+                --children_count;
+                progress = true;
+            }
+            if (pid < 0 && errno == ECHILD) {
+                break;
+            }
+            if (!progress) {
+                usleep(1000);
+            }
+        }
+
+        // Free allocated memory
+        free(p_context->source_analyzers_pids);
+        free(p_context->destination_analyzers_pids);
+        p_context->source_analyzers_pids = NULL;
+        p_context->destination_analyzers_pids = NULL;
+
+        // Free the MQ
+        msgctl(p_context->message_queue_id, IPC_RMID, NULL);
+        p_context->message_queue_id = -1;
+    }
+
+    if (p_context->shared_segment != NULL) {
+        stats_detach();
+        throttle_detach();
+        if (p_context->shared_segment != &local_segment) {
+            shmdt(p_context->shared_segment);
+        }
+        p_context->shared_segment = NULL;
+        if (the_config->prints_stats) {
+            print_stats_json(stdout);
+        }
+    }
+    clear_dir_cache();
+}
+
+/*!
+ * @brief request_element_details sends an entry to the analyzers and counts it as in flight
+ * @param msg_queue is the id of the MQ
+ * @param entry is the entry to analyze
+ * @param cfg is a pointer to the lister configuration
+ * @param current_analyzers is a pointer to the number of requests in flight
+ */
+void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers) {
+    if (send_analyze_file_command(msg_queue, cfg->my_recipient_id, entry) == 0) {
+        ++*current_analyzers;
+    }
 }
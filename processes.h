@@ -5,9 +5,19 @@
 #include <sys/types.h>
 #include <files-list.h>
 #include <stdbool.h>
+#include <stats.h>
+#include <throttle.h>
+
+// Memory shared by the main process and its children, set up by prepare
+typedef struct {
+    stats_t stats;
+    throttle_t throttle;
+} shared_segment_t;
 
 typedef struct {
     uint8_t processes_count;
+    uint8_t source_analyzers_count;
+    uint8_t destination_analyzers_count;
     pid_t main_process_pid;
     pid_t source_lister_pid;
     pid_t destination_lister_pid;
@@ -15,6 +25,8 @@ typedef struct {
     pid_t *destination_analyzers_pids;
     key_t shared_key;
     int message_queue_id;
+    int shared_segment_id;
+    shared_segment_t *shared_segment;
 } process_context_t;
 
 typedef struct {
@@ -22,13 +34,17 @@ typedef struct {
     int my_receiver_id; // Id of MQ topic to listen to
     int analyzers_count; // Number of analyzers available
     key_t mq_key;
+    int mq_id; // Id of the MQ, created by the main process
+    bool adapts_window; // Set to true to tune the number of requests in flight from the throughput (-n auto)
 } lister_configuration_t;
 
 typedef struct {
     int my_recipient_id; // Id of my lister
     int my_receiver_id; // Id I must listen to
     key_t mq_key;
-    bool use_md5; // Set to true when computing MD5sum for files
+    int mq_id; // Id of the MQ, created by the main process
+    char *source; // Roots of the synchronization, to find the copy of a source file to verify
+    char *destination;
 } analyzer_configuration_t;
 
 typedef void (*process_loop_t)(void *);
@@ -0,0 +1,140 @@
+#include <stats.h>
+#include <utility.h>
+#include <string.h>
+
+// Statistics being recorded, NULL when they are disabled: every function then returns immediately
+static stats_t *current_stats = NULL;
+// Copy of the statistics once detached from the shared segment
+static stats_t detached_stats;
+
+static const char *counters_names[STAT_COUNTERS_COUNT] = {
+    "entries_listed",
+    "files_hashed",
+    "bytes_hashed",
+    "files_copied",
+    "bytes_copied_sendfile",
+    "files_cloned",
+    "bytes_copied_reflink",
+    "files_linked",
+    "files_renamed",
+    "files_verified",
+    "bytes_verified",
+    "verify_mismatches",
+    "dirs_reused",
+    "digests_reused",
+    "stale_cache_records",
+    "files_sampled",
+    "bytes_sampled",
+    "fingerprints_confirmed",
+    "mq_messages_sent",
+    "mq_bytes_sent",
+    "mq_messages_received",
+    "mq_bytes_received",
+    "list_ns",
+    "hash_ns",
+    "ipc_wait_ns",
+    "diff_ns",
+    "apply_ns",
+    "copy_ns",
+    "analyzer_busy_ns",
+    "analyzer_idle_ns",
+};
+
+static const char *histograms_names[HISTOGRAMS_COUNT] = {
+    "hash_latency_us",
+    "copy_latency_us",
+};
+
+/*!
+ * @brief stats_attach enables the statistics, recorded into storage
+ * @param storage is the memory where to record them (zeroed), shared when the processes must share their statistics
+ */
+void stats_attach(stats_t *storage) {
+    current_stats = storage;
+    if (current_stats != NULL) {
+        current_stats->start_ns = monotonic_ns();
+    }
+}
+
+/*!
+ * @brief stats_detach copies the statistics out of their storage, so that it can be released
+ * The statistics are still readable (@see print_stats_json), but not updated anymore.
+ */
+void stats_detach(void) {
+    if (current_stats == NULL || current_stats == &detached_stats) {
+        return;
+    }
+    memcpy(&detached_stats, current_stats, sizeof(stats_t));
+    current_stats = &detached_stats;
+}
+
+/*!
+ * @brief stats_clock gives the start time of a measure
+ * @return the current time in nanoseconds, 0 when the statistics are disabled (to avoid reading the clock)
+ */
+uint64_t stats_clock(void) {
+    return (current_stats != NULL) ? monotonic_ns() : 0;
+}
+
+/*!
+ * @brief stats_add adds a value to a counter
+ * @param counter is the counter to update
+ * @param value is the value to add
+ */
+void stats_add(stats_counter_t counter, uint64_t value) {
+    if (current_stats != NULL) {
+        __atomic_fetch_add(&current_stats->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_add_time adds the time elapsed since start to a counter
+ * @param counter is the counter to update (a *_NS counter)
+ * @param start is the start of the measure (@see stats_clock)
+ */
+void stats_add_time(stats_counter_t counter, uint64_t start) {
+    if (current_stats != NULL) {
+        __atomic_fetch_add(&current_stats->counters[counter], monotonic_ns() - start, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_record_latency counts the latency of an operation in a histogram
+ * @param histogram is the histogram to update
+ * @param start is the start of the operation (@see stats_clock)
+ */
+void stats_record_latency(stats_histogram_t histogram, uint64_t start) {
+    if (current_stats == NULL) {
+        return;
+    }
+    uint64_t latency_us = (monotonic_ns() - start) / 1000;
+    int bucket = (latency_us == 0) ? 0 : 64 - __builtin_clzll(latency_us);
+    if (bucket >= HISTOGRAM_BUCKETS) {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&current_stats->histograms[histogram][bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief print_stats_json prints the statistics as a JSON object
+ * Times are printed in nanoseconds as recorded. Histograms are arrays of HISTOGRAM_BUCKETS counts.
+ * @param stream is the stream to print into
+ */
+void print_stats_json(FILE *stream) {
+    if (current_stats == NULL) {
+        return;
+    }
+    fprintf(stream, "{\n  \"wall_ns\": %lu,\n  \"counters\": {\n", (unsigned long) (monotonic_ns() - current_stats->start_ns));
+    for (int i=0; i<STAT_COUNTERS_COUNT; ++i) {
+        fprintf(stream, "    \"%s\": %lu%s\n", counters_names[i], (unsigned long) current_stats->counters[i], (i < STAT_COUNTERS_COUNT - 1) ? "," : "");
+    }
+    fprintf(stream, "  },\n  \"histograms\": {\n");
+    for (int i=0; i<HISTOGRAMS_COUNT; ++i) {
+        fprintf(stream, "    \"%s\": [", histograms_names[i]);
+        for (int j=0; j<HISTOGRAM_BUCKETS; ++j) {
+            fprintf(stream, "%lu%s", (unsigned long) current_stats->histograms[i][j], (j < HISTOGRAM_BUCKETS - 1) ? ", " : "");
+        }
+        fprintf(stream, "]%s\n", (i < HISTOGRAMS_COUNT - 1) ? "," : "");
+    }
+    fprintf(stream, "  }\n}\n");
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters are updated atomically: the statistics can be shared by all the processes (@see prepare)
+typedef enum {
+    STAT_ENTRIES_LISTED,
+    STAT_FILES_HASHED,
+    STAT_BYTES_HASHED,
+    STAT_FILES_COPIED,
+    STAT_BYTES_COPIED_SENDFILE,
+    STAT_FILES_CLONED,
+    STAT_BYTES_COPIED_REFLINK,
+    STAT_FILES_LINKED,
+    STAT_FILES_RENAMED,
+    STAT_FILES_VERIFIED,
+    STAT_BYTES_VERIFIED,
+    STAT_VERIFY_MISMATCHES,
+    STAT_DIRS_REUSED,
+    STAT_DIGESTS_REUSED,
+    STAT_STALE_CACHE_RECORDS,
+    STAT_FILES_SAMPLED,
+    STAT_BYTES_SAMPLED,
+    STAT_FINGERPRINTS_CONFIRMED,
+    STAT_MQ_MESSAGES_SENT,
+    STAT_MQ_BYTES_SENT,
+    STAT_MQ_MESSAGES_RECEIVED,
+    STAT_MQ_BYTES_RECEIVED,
+    STAT_LIST_NS,
+    STAT_HASH_NS,
+    STAT_IPC_WAIT_NS,
+    STAT_DIFF_NS,
+    STAT_APPLY_NS,
+    STAT_COPY_NS,
+    STAT_ANALYZER_BUSY_NS,
+    STAT_ANALYZER_IDLE_NS,
+    STAT_COUNTERS_COUNT
+} stats_counter_t;
+
+typedef enum {
+    HISTOGRAM_HASH_LATENCY,
+    HISTOGRAM_COPY_LATENCY,
+    HISTOGRAMS_COUNT
+} stats_histogram_t;
+
+// Latencies are counted in power of 2 buckets of microseconds: bucket i counts latencies in [2^(i-1), 2^i[ us
+#define HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t counters[STAT_COUNTERS_COUNT];
+    uint64_t histograms[HISTOGRAMS_COUNT][HISTOGRAM_BUCKETS];
+} stats_t;
+
+void stats_attach(stats_t *storage);
+void stats_detach(void);
+uint64_t stats_clock(void);
+void stats_add(stats_counter_t counter, uint64_t value);
+void stats_add_time(stats_counter_t counter, uint64_t start);
+void stats_record_latency(stats_histogram_t histogram, uint64_t start);
+void print_stats_json(FILE *stream);
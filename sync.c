@@ -8,50 +8,559 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <unistd.h>
 #include <sys/msg.h>
+#include <digest-index.h>
+#include <journal.h>
+#include <plan.h>
+#include <watch.h>
+#include <stats.h>
+#include <cache-policy.h>
+#include <throttle.h>
+#include <filter.h>
+#include <bounded-sync.h>
+#include <dir-cache.h>
+#include <io-order.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 
 /*!
- * @brief synchronize is the main function for synchronization
- * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
- * It must adapt to the parallel or not operation of the program.
+ * @brief same_content confirms that a file found by its digest has the content of a source file
+ * Equal MD5 sums are conclusive, as are equal fingerprints of files sampled completely. Else the match of the
+ * fingerprints is only likely, and both files are hashed completely (--quick-hash).
+ * @param source_entry is the source file
+ * @param candidate_path is the path of the file with the same size and digest
+ * @return true if both files have the same content
+ */
+static bool same_content(files_list_entry_t *source_entry, char *candidate_path) {
+  if ((get_digests() & DIGEST_MD5) != 0 || fingerprint_covers_file(source_entry->size)) {
+    return true;
+  }
+  files_list_entry_t source_probe;
+  files_list_entry_t candidate_probe;
+  strcpy(source_probe.path_and_name, source_entry->path_and_name);
+  if (strlen(candidate_path) >= sizeof(candidate_probe.path_and_name)) {
+    return false;
+  }
+  strcpy(candidate_probe.path_and_name, candidate_path);
+  stats_add(STAT_FINGERPRINTS_CONFIRMED, 1);
+  return compute_file_md5(&source_probe) == 0 && compute_file_md5(&candidate_probe) == 0
+         && memcmp(source_probe.md5sum, candidate_probe.md5sum, sizeof(source_probe.md5sum)) == 0;
+}
+
+/*!
+ * @brief relocate_from_index tries to put a file in place in the destination from a file already there with the same content
+ * An orphan destination file (i.e. with no counterpart in the source) is renamed, another file is hard linked, so that
+ * moving or renaming files in the source costs metadata operations instead of copies.
+ * A file is only hard linked when its mode and mtime are the ones of the source entry, since they are shared by the links.
+ * Matches of quick fingerprints are confirmed by hashing both files (@see same_content).
+ * @param source_entry is the source file to synchronize
+ * @param index is the index of the destination files contents
  * @param the_config is a pointer to the configuration
- * @param p_context is a pointer to the processes context
+ * @param previous_path receives the former path of the renamed destination file, an empty string when a file was
+ * linked (PATH_SIZE long, NULL if not needed)
+ * @return true if the file was relocated, false if it must be copied
  */
-void synchronize(configuration_t *the_config, process_context_t *p_context) {
+bool relocate_from_index(files_list_entry_t *source_entry, digest_index_t *index, configuration_t *the_config, char *previous_path) {
+  char destination_file[PATH_SIZE];
+  if (concat_path(destination_file, the_config->destination, relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+    return false;
+  }
 
-  // création des listes de fichier
-  files_list_t *liste_source, *liste_dest;
-  make_files_list(source_list, the_config->source);
-  make_files_list(dest_list, the_config->destination);
+  // d'abord un fichier orphelin qui peut être renommé
+  for (digest_index_node_t *node = find_in_digest_index(index, source_entry, NULL); node != NULL; node = find_in_digest_index(index, source_entry, node)) {
+    if (!node->is_orphan || !same_content(source_entry, digest_index_node_path(node))) {
+      continue;
+    }
+    if (the_config->is_dry_run || the_config->is_verbose) {
+      printf("rename %s -> %s\n", digest_index_node_path(node), destination_file);
+    }
+    if (!the_config->is_dry_run) {
+      if (rename(digest_index_node_path(node), destination_file) != 0) {
+        continue;
+      }
+      stats_add(STAT_FILES_RENAMED, 1);
+      struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, source_entry->mtime};
+      chmod(destination_file, source_entry->mode);
+      utimensat(AT_FDCWD, destination_file, times, 0);
+    }
+    // le contenu est maintenant à sa nouvelle place, avec les propriétés de la source : l'entrée de la destination
+    // (dans la liste et l'index) est déplacée avec lui, son ancien chemin n'existe plus
+    if (previous_path != NULL) {
+      strcpy(previous_path, node->entry->path_and_name);
+    }
+    strcpy(node->entry->path_and_name, destination_file);
+    free(node->destination_path);
+    node->destination_path = NULL;
+    node->is_orphan = false;
+    node->entry->mode = source_entry->mode;
+    node->entry->mtime = source_entry->mtime;
+    return true;
+  }
+
+  // sinon un fichier identique (contenu et propriétés) qui peut être lié
+  for (digest_index_node_t *node = find_in_digest_index(index, source_entry, NULL); node != NULL; node = find_in_digest_index(index, source_entry, node)) {
+    if (node->entry->mode != source_entry->mode || node->entry->mtime.tv_sec != source_entry->mtime.tv_sec || node->entry->mtime.tv_nsec != source_entry->mtime.tv_nsec
+        || !same_content(source_entry, digest_index_node_path(node))) {
+      continue;
+    }
+    if (the_config->is_dry_run || the_config->is_verbose) {
+      printf("link %s -> %s\n", digest_index_node_path(node), destination_file);
+    }
+    if (!the_config->is_dry_run) {
+      unlink(destination_file);
+      if (link(digest_index_node_path(node), destination_file) != 0) {
+        continue;
+      }
+      stats_add(STAT_FILES_LINKED, 1);
+    }
+    if (previous_path != NULL) {
+      previous_path[0] = '\0';
+    }
+    return true;
+  }
+  return false;
+}
+
+/*!
+ * @brief clone_file makes destination_file a reflink (copy on write clone) of model_file
+ * @param model_file is the path of a file already in the destination
+ * @param destination_file is the path of the clone to create
+ * @param mode is the access mode of the clone
+ * @return 0 in case of success, -1 else (e.g. the filesystem has no reflink support)
+ */
+static int clone_file(char *model_file, char *destination_file, mode_t mode) {
+  int fd_model = open(model_file, O_RDONLY);
+  if (fd_model < 0) {
+    return -1;
+  }
+  unlink(destination_file);
+  int fd_destination = open(destination_file, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (fd_destination < 0) {
+    close(fd_model);
+    return -1;
+  }
+  int result = ioctl(fd_destination, FICLONE, fd_model);
+  close(fd_model);
+  close(fd_destination);
+  if (result != 0) {
+    unlink(destination_file);
+    return -1;
+  }
+  return 0;
+}
 
-  // pointeur vers les entrées courantes
-  files_list_entry_t *current_entry = liste_source->head;
-  files_list_entry_t *current_dest;
+/*!
+ * @brief dedup_from_index materializes a file from an identical file already copied during this synchronization
+ * It makes a reflink of the first copy when the filesystem supports it, so that the clone keeps its own mode and mtime.
+ * Else, it hard links the first copy, but only if it has the same mode and mtime as the source entry.
+ * @param source_entry is the source file to synchronize
+ * @param index is the index of the files copied during this synchronization
+ * @param the_config is a pointer to the configuration
+ * @return true if the file was materialized, false if it must be copied
+ */
+static bool dedup_from_index(files_list_entry_t *source_entry, digest_index_t *index, configuration_t *the_config) {
+  char destination_file[PATH_SIZE];
+  if (concat_path(destination_file, the_config->destination, relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+    return false;
+  }
 
-  // parcourir toutes les entrées du repertoire source
-  while (current_entry != NULL) {
+  for (digest_index_node_t *node = find_in_digest_index(index, source_entry, NULL); node != NULL; node = find_in_digest_index(index, source_entry, node)) {
+    if (!same_content(source_entry, node->entry->path_and_name)) {
+      continue;
+    }
+    bool same_metadata = node->entry->mode == source_entry->mode && node->entry->mtime.tv_sec == source_entry->mtime.tv_sec && node->entry->mtime.tv_nsec == source_entry->mtime.tv_nsec;
+    if (the_config->is_dry_run) {
+      printf("dedup %s -> %s\n", digest_index_node_path(node), destination_file);
+      return true;
+    }
+    if (clone_file(digest_index_node_path(node), destination_file, source_entry->mode) == 0) {
+      stats_add(STAT_FILES_CLONED, 1);
+      stats_add(STAT_BYTES_COPIED_REFLINK, source_entry->size);
+      struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, source_entry->mtime};
+      chmod(destination_file, source_entry->mode);
+      utimensat(AT_FDCWD, destination_file, times, 0);
+      if (the_config->is_verbose) {
+        printf("clone %s -> %s\n", digest_index_node_path(node), destination_file);
+      }
+      return true;
+    }
+    // les liens partagent mode et date de modification
+    if (same_metadata && link(digest_index_node_path(node), destination_file) == 0) {
+      stats_add(STAT_FILES_LINKED, 1);
+      if (the_config->is_verbose) {
+        printf("link %s -> %s\n", digest_index_node_path(node), destination_file);
+      }
+      return true;
+    }
+  }
+  return false;
+}
 
-    // trouver l'entrée correspondante dans le repertoire de destination et la copier si besoin
-    files_list_entry_t *current_dest = find_entry_by_name(liste_dest, current_entry->path_and_name, 0 ,0);
+/*!
+ * @brief make_differences_list compares the source and destination lists and lists the entries to synchronize
+ * Both lists are ordered, so they are walked together. Destination files that will not be replaced are added to
+ * the index of the destination contents, with their orphan status.
+ * @param the_config is a pointer to the configuration
+ * @param source_list is the list of the source tree
+ * @param destination_list is the list of the destination tree
+ * @param differences_list is the list where to add the source entries to synchronize
+ * @param destination_index is the index of the destination contents, NULL if no index is used
+ */
+void make_differences_list(configuration_t *the_config, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list, digest_index_t *destination_index) {
+  uint64_t start = stats_clock();
+  files_list_entry_t *current_entry = source_list->head;
+  files_list_entry_t *current_dest = destination_list->head;
+  while (current_entry != NULL || current_dest != NULL) {
+    int cmp_result;
+    if (current_entry == NULL) {
+      cmp_result = 1;
+    } else if (current_dest == NULL) {
+      cmp_result = -1;
+    } else {
+      cmp_result = strcmp(relative_path(current_entry->path_and_name, the_config->source), relative_path(current_dest->path_and_name, the_config->destination));
+    }
 
-    // si l'entrée n'est pas trouvé
-    if (current_dest == NULL) {
-      copy_entry_to_destination(current_entry, the_config);
+    if (cmp_result < 0) {
+      // l'entrée n'existe pas dans la destination
+      add_entry_to_tail(differences_list, current_entry);
+      current_entry = current_entry->next;
+    } else if (cmp_result > 0) {
+      // l'entrée n'existe que dans la destination : elle peut être renommée
+      if (destination_index != NULL) {
+        add_to_digest_index(destination_index, current_dest, true);
+      }
+      current_dest = current_dest->next;
     } else {
-      // si il y a une différence
+      // si il y a une différence, le fichier de la destination sera remplacé : il ne peut pas servir de modèle
       if (mismatch(current_entry, current_dest, the_config->uses_md5)) {
-        copy_entry_to_destination(current_entry, the_config);
+        add_entry_to_tail(differences_list, current_entry);
+      } else if (destination_index != NULL) {
+        add_to_digest_index(destination_index, current_dest, false);
+      }
+      current_entry = current_entry->next;
+      current_dest = current_dest->next;
+    }
+  }
+  stats_add_time(STAT_DIFF_NS, start);
+}
+
+/*!
+ * @brief apply_differences applies the differences list to the destination
+ * Each entry of the differences list is an operation, numbered in the list order. Completed operations are
+ * recorded in the journal, and operations already done by an interrupted run are skipped.
+ * Directories are created first, then the files are copied in the I/O order of the source (@see make_io_order).
+ * @param the_config is a pointer to the configuration
+ * @param differences_list is the list of the source entries to synchronize
+ * @param destination_index is the index of the destination contents, NULL if none
+ * @param copied_index is the index of the files copied during the run for deduplication, NULL if none
+ * @param journal is the journal of the run, NULL if none
+ * @param done_operations tells for each operation if it was already done, NULL if none were
+ * @param copied_list receives the copied files to verify, NULL if they are not verified
+ */
+static void apply_differences(configuration_t *the_config, files_list_t *differences_list, digest_index_t *destination_index, digest_index_t *copied_index, journal_t *journal, uint8_t *done_operations, files_list_t *copied_list) {
+  uint64_t start = stats_clock();
+  // les opérations gardent leur numéro dans la liste, seul l'ordre des copies change (--io-order)
+  size_t count;
+  io_order_item_t *order = make_io_order(differences_list, &count);
+  if (order == NULL && differences_list->head != NULL) {
+    fprintf(stderr, "Not enough memory to apply the differences\n");
+    return;
+  }
+  for (size_t i=0; i<count; ++i) {
+    files_list_entry_t *cursor = order[i].entry;
+    uint64_t operation = order[i].index;
+    if (done_operations != NULL && done_operations[operation]) {
+      continue;
+    }
+
+    int result = 0;
+    if (cursor->entry_type == FICHIER && destination_index != NULL && relocate_from_index(cursor, destination_index, the_config, NULL)) {
+      result = 0;
+    } else if (cursor->entry_type == FICHIER && copied_index != NULL && dedup_from_index(cursor, copied_index, the_config)) {
+      result = 0;
+    } else {
+      result = copy_entry_to_destination(cursor, the_config);
+      if (result == 0 && cursor->entry_type == FICHIER && copied_list != NULL && !the_config->is_dry_run) {
+        add_entry_to_tail(copied_list, cursor);
+      }
+
+      // la copie servira de modèle aux fichiers identiques suivants
+      if (result == 0 && cursor->entry_type == FICHIER && copied_index != NULL) {
+        char destination_file[PATH_SIZE];
+        digest_index_node_t *node = add_to_digest_index(copied_index, cursor, false);
+        if (node != NULL && concat_path(destination_file, the_config->destination, relative_path(cursor->path_and_name, the_config->source)) != NULL) {
+          node->destination_path = strdup(destination_file);
+        }
+      }
+    }
+
+    if (result == 0 && journal != NULL) {
+      journal_operation_done(journal, operation);
+    }
+  }
+  free(order);
+  stats_add_time(STAT_APPLY_NS, start);
+}
+
+/*!
+ * @brief copy_matches reads a copied file from the destination, bypassing the page cache, and compares it with the
+ * MD5 sum of its source
+ * @param destination_path is the path of the copy
+ * @param source_entry is the source entry, with its MD5 sum
+ * @return true if the copy matches the source, false else
+ */
+static bool copy_matches(char *destination_path, files_list_entry_t *source_entry) {
+  unsigned char md5sum[sizeof(source_entry->md5sum)];
+  return compute_file_md5_uncached(destination_path, md5sum) == 0 && memcmp(md5sum, source_entry->md5sum, sizeof(md5sum)) == 0;
+}
+
+/*!
+ * @brief recopy_mismatch copies again a file whose copy doesn't match the source, and verifies the new copy
+ * @param destination_path is the path of the copy
+ * @param source_entry is the source entry, with its MD5 sum
+ * @param the_config is a pointer to the configuration
+ * @return 0 if the new copy matches the source, -1 else
+ */
+static int recopy_mismatch(char *destination_path, files_list_entry_t *source_entry, configuration_t *the_config) {
+  stats_add(STAT_VERIFY_MISMATCHES, 1);
+  fprintf(stderr, "%s: copy doesn't match the source, copying again\n", destination_path);
+  if (copy_entry_to_destination(source_entry, the_config) == 0 && copy_matches(destination_path, source_entry)) {
+    return 0;
+  }
+  fprintf(stderr, "%s: copy is corrupted\n", destination_path);
+  return -1;
+}
+
+/*!
+ * @brief verify_copies reads the copied files again from the destination and compares them with their source MD5 sum
+ * In parallel mode, the files are verified by the destination analyzers, with one request in flight per analyzer.
+ * With --quick-hash, the analyzers compute the MD5 sums of the sources as well.
+ * A file that doesn't match is copied and verified again (@see verify_copy).
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param copied_list is the list of the copied source entries
+ */
+static void verify_copies(configuration_t *the_config, process_context_t *p_context, files_list_t *copied_list) {
+  if (!the_config->is_parallel || p_context->message_queue_id == -1) {
+    for (files_list_entry_t *cursor = copied_list->head; cursor != NULL; cursor = cursor->next) {
+      verify_copy(cursor, the_config);
+    }
+    return;
+  }
+
+  int in_flight = 0;
+  files_list_entry_t *next_entry = copied_list->head;
+  any_message_t message;
+  while (next_entry != NULL || in_flight > 0) {
+    // les requêtes portent l'entrée source, l'analyseur en déduit le chemin de la copie
+    while (next_entry != NULL && in_flight < p_context->destination_analyzers_count) {
+      if (send_verify_file_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS, next_entry) == 0) {
+        ++in_flight;
+      }
+      next_entry = next_entry->next;
+    }
+    if (in_flight == 0) {
+      continue;
+    }
+    if (receive_message(p_context->message_queue_id, &message, MSG_TYPE_TO_MAIN) < 0) {
+      perror("msgrcv");
+      return;
+    }
+    if (message.analyze_file_command.op_code == COMMAND_CODE_FILE_CORRUPTED) {
+      // la réponse porte la somme MD5 de la source, calculée par l'analyseur avec --quick-hash
+      char destination_path[PATH_SIZE];
+      if (concat_path(destination_path, the_config->destination, relative_path(message.analyze_file_command.payload.path_and_name, the_config->source)) != NULL) {
+        recopy_mismatch(destination_path, &message.analyze_file_command.payload, the_config);
       }
     }
-    current_entry = current_entry->next;
+    if (message.analyze_file_command.op_code == COMMAND_CODE_FILE_VERIFIED || message.analyze_file_command.op_code == COMMAND_CODE_FILE_CORRUPTED) {
+      --in_flight;
+    }
+  }
+}
+
+/*!
+ * @brief apply_with_journal applies a differences list, journaled unless in dry run mode
+ * With deduplication enabled, new files identical to a file copied earlier in the run are cloned or linked (@see dedup_from_index)
+ * With verification enabled, the copied files are verified once all the differences are applied (@see verify_copies)
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param differences_list is the list of the source entries to synchronize
+ * @param destination_index is the index of the destination contents, NULL if none
+ * @param done_operations tells for each operation if it was already done, NULL if none were
+ * @param is_resumed tells if the differences list was loaded from the journal of an interrupted run
+ */
+static void apply_with_journal(configuration_t *the_config, process_context_t *p_context, files_list_t *differences_list, digest_index_t *destination_index, uint8_t *done_operations, bool is_resumed) {
+  // index des fichiers copiés pendant cette synchronisation, pour la déduplication
+  digest_index_t copied_index;
+  bool uses_dedup = the_config->uses_dedup && the_config->uses_md5 && init_digest_index(&copied_index, 0) == 0;
+
+  journal_t journal;
+  bool uses_journal = !the_config->is_dry_run && open_journal(&journal, the_config, differences_list, is_resumed) == 0;
+  files_list_t copied_list = {NULL, NULL};
+  apply_differences(the_config, differences_list, destination_index, uses_dedup ? &copied_index : NULL, uses_journal ? &journal : NULL, done_operations, the_config->is_verifying ? &copied_list : NULL);
+  if (copied_list.head != NULL) {
+    verify_copies(the_config, p_context, &copied_list);
+    clear_files_list(&copied_list);
+  }
+  if (uses_journal) {
+    close_journal(&journal, the_config);
+  }
+  if (uses_dedup) {
+    clear_digest_index(&copied_index);
   }
 }
 
+/*!
+ * @brief synchronize_trees lists both trees, compares them and applies the differences (or saves them to a plan file)
+ * Files missing from the destination are first looked up by content (size and MD5) among the destination files, so that
+ * renamed or moved files are renamed or linked instead of being copied again (@see relocate_from_index)
+ * With --dir-cache, the listings and MD5 sums of the unchanged entries are saved for the next run (@see save_dir_cache)
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param source_list is a pointer to an empty list, receiving the source list
+ * @param destination_list is a pointer to an empty list, receiving the destination list
+ * @param differences_list is a pointer to an empty list, receiving the differences list
+ * The lists are left to the caller, which must clear them.
+ */
+void synchronize_trees(configuration_t *the_config, process_context_t *p_context, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list) {
+  // les entrées modifiées après le début du parcours ne sont pas gardées dans le cache des dossiers
+  struct timespec listing_start;
+  clock_gettime(CLOCK_REALTIME, &listing_start);
+
+  // création des listes de fichier
+  if (the_config->is_parallel) {
+    make_files_lists_parallel(source_list, destination_list, the_config, p_context->message_queue_id);
+  } else {
+    make_files_list(source_list, the_config->source);
+    make_files_list(destination_list, the_config->destination);
+  }
+
+  if (the_config->is_verbose) {
+    printf("Source list:\n");
+    display_files_list(source_list);
+    printf("Destination list:\n");
+    display_files_list(destination_list);
+  }
+
+  // index des contenus de la destination, seulement si les sommes MD5 sont calculées
+  digest_index_t destination_index;
+  bool uses_index = the_config->uses_md5 && init_digest_index(&destination_index, 0) == 0;
+
+  make_differences_list(the_config, source_list, destination_list, differences_list, uses_index ? &destination_index : NULL);
+
+  if (the_config->plan_output_path[0] != '\0') {
+    // le plan est enregistré pour être appliqué plus tard (--apply), rien n'est modifié maintenant
+    if (write_plan(the_config->plan_output_path, the_config, differences_list, uses_index ? &destination_index : NULL) == 0 && the_config->is_verbose) {
+      printf("Plan saved to %s\n", the_config->plan_output_path);
+    }
+  } else {
+    apply_with_journal(the_config, p_context, differences_list, uses_index ? &destination_index : NULL, NULL, false);
+  }
+
+  if (the_config->uses_dir_cache && !the_config->is_dry_run) {
+    save_dir_cache(the_config, source_list, destination_list, &listing_start);
+  } else if (the_config->uses_quick_hash && !the_config->is_dry_run) {
+    // sans cache des dossiers, les exécutions depuis le dernier calcul complet des sommes MD5 sont comptées à part
+    save_quick_hash_runs(the_config);
+  }
+
+  if (uses_index) {
+    clear_digest_index(&destination_index);
+  }
+}
+
+/*!
+ * @brief synchronize is the main function for synchronization
+ * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
+ * It must adapt to the parallel or not operation of the program.
+ * The differences list and the completed operations are journaled: when a previous run was interrupted, its journal
+ * is loaded instead of listing the trees again, and only the remaining operations are applied. It is not resumed by
+ * a run with --plan-out, which must not change the destination, and a plan is not applied until it is resumed.
+ * The differences list can also be saved to a plan file instead of being applied, or loaded from a plan file
+ * instead of being computed (@see write_plan, read_plan).
+ * With a memory limit, the trees are compared as sorted streams instead of lists (@see synchronize_bounded).
+ * In watch mode, the lists are kept after the synchronization to synchronize the source changes as they happen (@see watch_source),
+ * also after resuming an interrupted synchronization.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+void synchronize(configuration_t *the_config, process_context_t *p_context) {
+  files_list_t source_list = {NULL, NULL};
+  files_list_t destination_list = {NULL, NULL};
+  files_list_t differences_list = {NULL, NULL};
+  uint8_t *done_operations = NULL;
+
+  int journal_status = the_config->is_dry_run ? 0 : load_journal(the_config, &differences_list, &done_operations);
+  if (journal_status == 1 && (the_config->plan_output_path[0] != '\0' || the_config->plan_input_path[0] != '\0')) {
+    // un plan ne reprend pas la synchronisation interrompue : --plan-out ne modifie pas la destination, et --apply
+    // appliquerait un plan calculé avant que la destination soit complète
+    fprintf(stderr, "An interrupted synchronization is pending, run again without --plan-out or --apply to resume it\n");
+    free(done_operations);
+    clear_files_list(&differences_list);
+    if (the_config->plan_input_path[0] != '\0') {
+      return;
+    }
+    done_operations = NULL;
+    journal_status = 0;
+  }
+
+  if (journal_status == 1) {
+    // reprise d'une synchronisation interrompue : les contenus de la destination ne sont pas connus sans parcours
+    if (the_config->is_verbose) {
+      printf("Resuming interrupted synchronization from its journal\n");
+    }
+    remove_temporary_files(the_config->destination);
+    int changed = revalidate_journal(&differences_list, done_operations, the_config->is_verbose);
+    if (changed > 0) {
+      printf("%d entries changed since the interruption and were updated or skipped\n", changed);
+    }
+    apply_with_journal(the_config, p_context, &differences_list, NULL, done_operations, true);
+    if (the_config->is_watching) {
+      // un démon relancé après un arrêt brutal reprend sa surveillance : les listes sont refaites après la reprise
+      clear_files_list(&differences_list);
+      synchronize_trees(the_config, p_context, &source_list, &destination_list, &differences_list);
+      watch_source(the_config, p_context, &source_list, &destination_list, &differences_list);
+    }
+  } else if (the_config->plan_input_path[0] != '\0') {
+    // plan calculé par une exécution précédente : seules les tailles et dates de la source sont vérifiées
+    // l'index des contenus de la destination est reconstruit à partir du plan, pour les renommages et les liens
+    digest_index_t destination_index;
+    bool uses_index = the_config->uses_md5 && init_digest_index(&destination_index, 0) == 0;
+    if (read_plan(the_config->plan_input_path, the_config, &differences_list, &destination_list, uses_index ? &destination_index : NULL) == 0) {
+      int skipped = revalidate_plan(&differences_list, the_config->is_verbose);
+      if (skipped > 0) {
+        printf("%d entries changed since the plan was computed and were skipped\n", skipped);
+      }
+      apply_with_journal(the_config, p_context, &differences_list, uses_index ? &destination_index : NULL, NULL, false);
+    }
+    if (uses_index) {
+      clear_digest_index(&destination_index);
+    }
+  } else if (the_config->memory_limit > 0) {
+    // les listes complètes ne tiennent pas en mémoire : elles sont triées sur disque et comparées au fil de l'eau
+    synchronize_bounded(the_config, p_context);
+  } else {
+    synchronize_trees(the_config, p_context, &source_list, &destination_list, &differences_list);
+    if (the_config->is_watching) {
+      watch_source(the_config, p_context, &source_list, &destination_list, &differences_list);
+    }
+  }
+
+  free(done_operations);
+  clear_files_list(&differences_list);
+  clear_files_list(&source_list);
+  clear_files_list(&destination_list);
+}
+
 /*!
  * @brief mismatch tests if two files with the same name (one in source, one in destination) are equal
+ * Directories only differ by their mode: their mtime changes each time their content does.
  * @param lhd a files list entry from the source
  * @param rhd a files list entry from the destination
  * @has_md5 a value to enable or disable MD5 sum check
@@ -59,10 +568,19 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
  */
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
 
-  // compare les sommes MD5 si activer
+  if (lhd->entry_type != rhd->entry_type) {
+    return true;
+  }
+  if (lhd->entry_type == DOSSIER) {
+    return lhd->mode != rhd->mode;
+  }
+
+  // compare les sommes MD5 si activer, ou les empreintes rapides (--quick-hash)
   if (has_md5 == true) {
+    uint8_t *lhd_digest = ((get_digests() & DIGEST_MD5) != 0) ? lhd->md5sum : lhd->fingerprint;
+    uint8_t *rhd_digest = ((get_digests() & DIGEST_MD5) != 0) ? rhd->md5sum : rhd->fingerprint;
     for (int i = 0; i < 16; i++) {
-      if (lhd->md5sum[i] != rhd->md5sum[i]) {
+      if (lhd_digest[i] != rhd_digest[i]) {
         return true;
       }
     }
@@ -90,12 +608,27 @@ void make_files_list(files_list_t *list, char *target_path) {
 
   make_list(list, target_path);
 
-  // parcourt la liste et obtient les statistiques de chaque fichier
-  files_list_entry_t *p_entry = list->head;
-  while (p_entry != NULL) {
-    get_file_stats(p_entry);
-    p_entry = p_entry->next;
+  // parcourt la liste et obtient les statistiques de chaque fichier, dans l'ordre des données sur le disque
+  // une entrée supprimée ou illisible depuis qu'elle a été listée est retirée, pour ne pas passer pour un fichier vide
+  size_t count;
+  io_order_item_t *order = make_io_order(list, &count);
+  if (order == NULL) {
+    files_list_entry_t *p_entry = list->head;
+    while (p_entry != NULL) {
+      files_list_entry_t *next = p_entry->next;
+      if (get_file_stats(p_entry) != 0) {
+        remove_entry_from_list(list, p_entry);
+      }
+      p_entry = next;
+    }
+    return;
+  }
+  for (size_t i=0; i<count; ++i) {
+    if (get_file_stats(order[i].entry) != 0) {
+      remove_entry_from_list(list, order[i].entry);
+    }
   }
+  free(order);
 }
 
 /*!
@@ -106,6 +639,27 @@ void make_files_list(files_list_t *list, char *target_path) {
  * @param msg_queue is the id of the MQ used for communication
  */
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
+  // chaque lister parcourt son arbre et fait analyser ses entrées, puis les envoie dans l'ordre
+  if (send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source) != 0 ||
+      send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination) != 0) {
+    perror("msgsnd");
+    return;
+  }
+
+  // les entrées des deux listes arrivent mélangées : reply_to indique la liste de chaque entrée
+  int remaining_listers = 2;
+  any_message_t message;
+  while (remaining_listers > 0) {
+    if (receive_message(msg_queue, &message, MSG_TYPE_TO_MAIN) < 0) {
+      perror("msgrcv");
+      return;
+    }
+    if (message.list_entry.op_code == COMMAND_CODE_LIST_COMPLETE) {
+      --remaining_listers;
+    } else if (message.list_entry.op_code == COMMAND_CODE_FILE_ENTRY) {
+      add_entry_to_tail(message.list_entry.reply_to == MSG_TYPE_TO_SOURCE_LISTER ? src_list : dst_list, &message.list_entry.payload);
+    }
+  }
 }
 
 /*!
@@ -113,46 +667,209 @@ void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, c
  * It keeps access modes and mtime (@see utimensat)
  * Pay attention to the path so that the prefixes are not repeated from the source to the destination
  * Use sendfile to copy the file, mkdir to create the directory
+ * Files are copied into a temporary file renamed afterwards, so that an interrupted copy never leaves a half
+ * written file in place of the destination file.
+ * @param source_entry is the entry to copy
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
  */
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
   //test erreur argument
   if (source_entry == NULL || the_config == NULL) {
     fprintf(stderr, "Invalid arguments to copy_entry_to_destination\n");
-    return;
+    return -1;
   }
 
-  //initialisation
-  char source[1024];
-  strcpy(source, the_config->source);
-  char destination[1024];
-  strcpy(destination, the_config->destination);
+  //construit le chemin dans la destination
+  char destination_path[PATH_SIZE];
+  if (concat_path(destination_path, the_config->destination, relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+    return -1;
+  }
+  if (the_config->is_dry_run || the_config->is_verbose) {
+    printf("%s %s -> %s\n", source_entry->entry_type == DOSSIER ? "mkdir" : "copy", source_entry->path_and_name, destination_path);
+  }
+  if (the_config->is_dry_run) {
+    return 0;
+  }
 
   //si dossier, créer dossier destination
   if (source_entry->entry_type == DOSSIER){
-    char path[PATH_SIZE];   
-    concat_path(path, destination, source_entry->path_and_name + strlen(the_config->source) + 1);
-    mkdir(path, source_entry->mode);
-  } else {
-    //si fichier, copie le fichier
-    off_t offset = 0;
-    char source_file[PATH_SIZE];
-    char destination_file[PATH_SIZE];
-
-    //construit les chemins des fichiers
-    concat_path(source_file, source, source_entry->path_and_name);
-    concat_path(destination_file, destination, source_entry->path_and_name + strlen(the_config->source) + 1);
-
-    //ouvre les fichiers
-    int fd_source, fd_destination;
-    fd_source = open(source_entry->path_and_name, O_RDONLY);
-    fd_destination = open(destination_file, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
-    sendfile(fd_destination, fd_source, &offset, source_entry->size);
-
-    //ferme les fichiers
+    if (mkdir(destination_path, source_entry->mode) != 0 && errno != EEXIST) {
+      perror(destination_path);
+      return -1;
+    }
+    chmod(destination_path, source_entry->mode);
+    return 0;
+  }
+
+  //si fichier, copie le fichier dans un fichier temporaire du même dossier
+  char temporary_path[PATH_SIZE];
+  char *file_name = strrchr(destination_path, '/');
+  file_name = (file_name == NULL) ? destination_path : file_name + 1;
+  if (snprintf(temporary_path, sizeof(temporary_path), "%.*s%s%s", (int) (file_name - destination_path), destination_path, TEMPORARY_FILE_PREFIX, file_name) >= (int) sizeof(temporary_path)) {
+    fprintf(stderr, "%s: path too long\n", destination_path);
+    return -1;
+  }
+
+  //ouvre les fichiers
+  uint64_t start = stats_clock();
+  int fd_source, fd_destination;
+  fd_source = open(source_entry->path_and_name, O_RDONLY);
+  if (fd_source < 0) {
+    perror(source_entry->path_and_name);
+    return -1;
+  }
+  fd_destination = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
+  if (fd_destination < 0) {
+    perror(temporary_path);
     close(fd_source);
-    close(fd_destination);
+    return -1;
   }
-  return;
+
+  //sendfile peut copier moins que demandé : on copie jusqu'à la fin du fichier
+  cache_window_t source_window, destination_window;
+  cache_window_open(&source_window, fd_source, false);
+  cache_window_open(&destination_window, fd_destination, true);
+  off_t offset = 0;
+  ssize_t copied;
+  throttle_consume(THROTTLE_FILES, 1);
+  while ((copied = sendfile(fd_destination, fd_source, &offset, COPY_CHUNK_SIZE)) > 0) {
+    cache_window_advance(&source_window, offset);
+    cache_window_advance(&destination_window, offset);
+    throttle_consume(THROTTLE_READ_BYTES, copied);
+    throttle_consume(THROTTLE_WRITE_BYTES, copied);
+  }
+
+  //conserve les droits et la date de modification
+  struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, source_entry->mtime};
+  int result = (copied == 0) ? 0 : -1;
+  if (result != 0) {
+    perror(source_entry->path_and_name);
+  } else if (fchmod(fd_destination, source_entry->mode) != 0 || futimens(fd_destination, times) != 0) {
+    perror(temporary_path);
+    result = -1;
+  }
+
+  //ferme les fichiers
+  cache_window_close(&source_window);
+  cache_window_close(&destination_window);
+  close(fd_source);
+  if (close(fd_destination) != 0) {
+    result = -1;
+  }
+
+  //remplace la destination, ce qui ne modifie pas un autre fichier qui y serait lié
+  if (result == 0 && rename(temporary_path, destination_path) != 0) {
+    perror(destination_path);
+    result = -1;
+  }
+  if (result != 0) {
+    unlink(temporary_path);
+  } else {
+    stats_add(STAT_FILES_COPIED, 1);
+    stats_add(STAT_BYTES_COPIED_SENDFILE, offset);
+    stats_add_time(STAT_COPY_NS, start);
+    stats_record_latency(HISTOGRAM_COPY_LATENCY, start);
+  }
+  return result;
+}
+
+/*!
+ * @brief verify_copy verifies a copied file (@see copy_matches), and copies it once again if it doesn't match
+ * @param source_entry is the copied entry, with its MD5 sum (computed here with --quick-hash)
+ * @param the_config is a pointer to the configuration
+ * @return 0 if the copy matches the source, -1 else
+ */
+int verify_copy(files_list_entry_t *source_entry, configuration_t *the_config) {
+  char destination_path[PATH_SIZE];
+  if (concat_path(destination_path, the_config->destination, relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+    return -1;
+  }
+  // avec les empreintes rapides, la somme MD5 de la source n'est calculée que pour les fichiers copiés
+  if ((get_digests() & DIGEST_MD5) == 0 && compute_file_md5(source_entry) != 0) {
+    return -1;
+  }
+  if (copy_matches(destination_path, source_entry)) {
+    return 0;
+  }
+  return recopy_mismatch(destination_path, source_entry, the_config);
+}
+
+/*!
+ * @brief list_child adds an entry of a directory to a list
+ * @param list is a pointer to the list (unused with a sorter)
+ * @param target is the path of the directory
+ * @param root is the root of the listed tree, the filter rules are relative to it
+ * @param sorter is a pointer to the sorter receiving the entries, NULL to add them to list
+ * @param name is the name of the entry
+ * @param new_entry is a pointer to the entry to fill
+ * @return 1 when the entry was added, 0 when it was skipped, -1 when the listing must stop
+ */
+static int list_child(files_list_t *list, char *target, char *root, external_sorter_t *sorter, char *name, files_list_entry_t *new_entry) {
+  // construit le chemin
+  if (concat_path(new_entry->path_and_name, target, name) == NULL) {
+    return 0;
+  }
+  if (is_filtered_out(relative_path(new_entry->path_and_name, root), new_entry->entry_type == DOSSIER)) {
+    return 0;
+  }
+
+  // ajoute le fichier dans la liste
+  if ((sorter != NULL ? external_sorter_add(sorter, new_entry) : add_entry_to_tail(list, new_entry)) != 0) {
+    return -1;
+  }
+  stats_add(STAT_ENTRIES_LISTED, 1);
+  return 1;
+}
+
+/*!
+ * @brief list_directory adds the content of a directory to a list, and recurses in its sub directories
+ * A directory unchanged since the previous synchronization is not read, its entries come from the directory
+ * cache (@see find_cached_directory)
+ * @param list is a pointer to the list (unused with a sorter)
+ * @param target is the path of the directory
+ * @param root is the root of the listed tree, the filter rules are relative to it
+ * @param sorter is a pointer to the sorter receiving the entries, NULL to add them to list
+ */
+static void list_directory(files_list_t *list, char *target, char *root, external_sorter_t *sorter) {
+  files_list_entry_t new_entry;
+  int result;
+
+  // dossier inchangé : ses entrées sont celles de la synchronisation précédente
+  struct stat dir_stat;
+  dir_cache_record_t *record = (lstat(target, &dir_stat) == 0) ? find_cached_directory(target, &dir_stat) : NULL;
+  if (record != NULL) {
+    for (uint32_t offset = 0; offset < record->children_size; offset += strlen(record->children + offset + 1) + 2) {
+      memset(&new_entry, 0, sizeof(new_entry));
+      new_entry.entry_type = (record->children[offset] == DOSSIER) ? DOSSIER : FICHIER;
+      if ((result = list_child(list, target, root, sorter, record->children + offset + 1, &new_entry)) < 0) {
+        break;
+      }
+      if (result > 0 && new_entry.entry_type == DOSSIER) {
+        list_directory(list, new_entry.path_and_name, root, sorter);
+      }
+    }
+    return;
+  }
+
+  //ouvre le dossier
+  DIR *dir = open_dir(target);
+  if (dir == NULL) {
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = get_next_entry(dir)) != NULL) {
+    memset(&new_entry, 0, sizeof(new_entry));
+    new_entry.entry_type = (entry->d_type == DT_DIR) ? DOSSIER : FICHIER;
+    if ((result = list_child(list, target, root, sorter, entry->d_name, &new_entry)) < 0) {
+      break;
+    }
+    if (result > 0 && new_entry.entry_type == DOSSIER) {
+      list_directory(list, new_entry.path_and_name, root, sorter);
+    }
+  }
+  closedir(dir);
 }
 
 /*!
@@ -169,28 +886,31 @@ void make_list(files_list_t *list, char *target) {
     return;
   }
 
-  //ouvre le dossier
-  DIR *dir = opendir(target);
-  if (dir == NULL) {
-    perror("Error opening directory");
-    return;
-  }
-
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    // Skip "." and ".."
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
-    }
+  uint64_t start = stats_clock();
+  list_directory(list, target, target, NULL);
+  stats_add_time(STAT_LIST_NS, start);
 
-    // construit le chemin
-    char file_path[4096];
-    snprintf(file_path, sizeof(file_path), "%s/%s", target, entry->d_name);
+  // les entrées sont ajoutées dans l'ordre de parcours, la liste doit être ordonnée
+  sort_files_list(list);
+}
 
-    // ajoute le fichier dans la liste
-    add_file_entry(list, file_path);
+/*!
+ * @brief make_sorted_list lists files in a location into a sorter, which keeps its memory use within its budget
+ * Like make_list, it doesn't get files properties. Entries are read back in order from the sorter.
+ * @param sorter is a pointer to the sorter receiving the entries
+ * @param target is the target dir whose content must be listed
+ * @return 0 in case of success, -1 else
+ */
+int make_sorted_list(external_sorter_t *sorter, char *target) {
+  if (sorter == NULL || target == NULL) {
+    fprintf(stderr, "Error: Invalid input parameters.\n");
+    return -1;
   }
-  closedir(dir);
+
+  uint64_t start = stats_clock();
+  list_directory(NULL, target, target, sorter);
+  stats_add_time(STAT_LIST_NS, start);
+  return external_sorter_finish(sorter);
 }
 
 /*!
@@ -212,7 +932,7 @@ DIR *open_dir(char *path) {
  * @brief get_next_entry returns the next entry in an already opened dir
  * @param dir is a pointer to the dir (as a result of opendir, @see open_dir)
  * @return a struct dirent pointer to the next relevant entry, NULL if none found (use it to stop iterating)
- * Relevant entries are all regular files and dir, except . and ..
+ * Relevant entries are all regular files and dir, except . and .. and the program's state files
  */
 struct dirent *get_next_entry(DIR *dir) {
   if (dir == NULL) {
@@ -222,7 +942,9 @@ struct dirent *get_next_entry(DIR *dir) {
   struct dirent *entry;
   while ((entry = readdir(dir)) != NULL) {
     // Check if the entry is relevant (not . or .. and is a regular file or directory)
-    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && (entry->d_type == DT_REG || entry->d_type == DT_DIR)) {
+    // Files whose name starts with STATE_FILES_PREFIX are the program's own (journal, temporary copies)
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && (entry->d_type == DT_REG || entry->d_type == DT_DIR)
+        && strncmp(entry->d_name, STATE_FILES_PREFIX, strlen(STATE_FILES_PREFIX)) != 0) {
       return entry; // Relevant entry found
     }
   }
@@ -5,12 +5,19 @@
 #include <configuration.h>
 #include <processes.h>
 #include <dirent.h>
+#include <external-sort.h>
+#include <digest-index.h>
 
 void synchronize(configuration_t *the_config, process_context_t *p_context);
+void synchronize_trees(configuration_t *the_config, process_context_t *p_context, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list);
+void make_differences_list(configuration_t *the_config, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list, digest_index_t *destination_index);
 void make_files_list(files_list_t *list, char *target_path);
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
+bool relocate_from_index(files_list_entry_t *source_entry, digest_index_t *index, configuration_t *the_config, char *previous_path);
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
+int verify_copy(files_list_entry_t *source_entry, configuration_t *the_config);
 void make_list(files_list_t *list, char *target);
+int make_sorted_list(external_sorter_t *sorter, char *target);
 DIR *open_dir(char *path);
 struct dirent *get_next_entry(DIR *dir);
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include <throttle.h>
+#include <defines.h>
+#include <utility.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Buckets in use: in the shared segment when the processes share them, else local to the process
+static throttle_t local_throttle;
+static throttle_t *current_throttle = &local_throttle;
+// Limits file reloaded on SIGHUP
+static char limits_path[PATH_SIZE];
+
+/*!
+ * @brief parse_rate reads a rate, with an optional K, M or G (powers of 1024) suffix
+ * It only uses async signal safe code, so that limits can be reloaded from a signal handler.
+ * @param text is the text to read, it may end with a new line
+ * @param rate is a pointer to the read rate
+ * @return 0 in case of success, -1 if the text is not a rate or doesn't fit on 64 bits
+ */
+int parse_rate(const char *text, uint64_t *rate) {
+    uint64_t value = 0;
+    uint64_t multiplier = 1;
+    const char *cursor = text;
+    if (*cursor < '0' || *cursor > '9') {
+        return -1;
+    }
+    for (; *cursor >= '0' && *cursor <= '9'; ++cursor) {
+        uint64_t digit = *cursor - '0';
+        if (value > (UINT64_MAX - digit) / 10) {
+            return -1;
+        }
+        value = value * 10 + digit;
+    }
+    switch (*cursor) {
+        case 'G': case 'g': multiplier = 1ULL << 30; ++cursor; break;
+        case 'M': case 'm': multiplier = 1ULL << 20; ++cursor; break;
+        case 'K': case 'k': multiplier = 1ULL << 10; ++cursor; break;
+    }
+    if ((*cursor != '\0' && *cursor != '\n') || value > UINT64_MAX / multiplier) {
+        return -1;
+    }
+    *rate = value * multiplier;
+    return 0;
+}
+
+/*!
+ * @brief throttle_attach makes the process use buckets shared with the other processes
+ * The current rates are kept.
+ * @param storage is the memory of the buckets (shared segment)
+ */
+void throttle_attach(throttle_t *storage) {
+    if (storage == NULL) {
+        return;
+    }
+    memcpy(storage, current_throttle, sizeof(throttle_t));
+    current_throttle = storage;
+}
+
+/*!
+ * @brief throttle_detach makes the process use local buckets again, so that the shared segment can be released
+ * The current rates are kept.
+ */
+void throttle_detach(void) {
+    if (current_throttle == &local_throttle) {
+        return;
+    }
+    memcpy(&local_throttle, current_throttle, sizeof(throttle_t));
+    current_throttle = &local_throttle;
+}
+
+/*!
+ * @brief throttle_set_rate changes the limit of a bucket, the waiting consumers apply it after their current slice
+ * The consumption not paid for yet is paid at the new rate. It only uses async signal safe code (SIGHUP handler).
+ * @param bucket is the bucket to change
+ * @param rate is the new rate, 0 to remove the limit
+ */
+void throttle_set_rate(throttle_bucket_id_t bucket, uint64_t rate) {
+    throttle_bucket_t *the_bucket = &current_throttle->buckets[bucket];
+    uint64_t old_rate = __atomic_exchange_n(&the_bucket->rate, rate, __ATOMIC_RELAXED);
+    if (old_rate == 0 || rate == 0 || old_rate == rate) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    uint64_t empty_at = __atomic_load_n(&the_bucket->empty_at_ns, __ATOMIC_RELAXED);
+    uint64_t new_empty_at;
+    do {
+        if (empty_at <= now) {
+            return;
+        }
+        new_empty_at = now + (uint64_t) ((double) (empty_at - now) * old_rate / rate);
+    } while (!__atomic_compare_exchange_n(&the_bucket->empty_at_ns, &empty_at, new_empty_at, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*!
+ * @brief is_throttled tells if a limit is set
+ * @return true if any bucket has a rate, false else
+ */
+bool is_throttled(void) {
+    for (int i=0; i<THROTTLE_BUCKETS_COUNT; ++i) {
+        if (__atomic_load_n(&current_throttle->buckets[i].rate, __ATOMIC_RELAXED) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief throttle_consume takes units from a bucket, and waits until they are paid for at the rate of the bucket
+ * The bucket keeps the time when it will be empty again: each consumer moves it forward atomically, then sleeps
+ * for the part beyond the allowed burst. So no lock is held while waiting. The sleep is cut in slices of
+ * THROTTLE_SLICE_NS, after which the rate is read again: the rest of the wait is rescaled when it changed.
+ * @param bucket is the bucket to consume from
+ * @param amount is the number of units (bytes or files) consumed
+ */
+void throttle_consume(throttle_bucket_id_t bucket, uint64_t amount) {
+    throttle_bucket_t *the_bucket = &current_throttle->buckets[bucket];
+    uint64_t rate = __atomic_load_n(&the_bucket->rate, __ATOMIC_RELAXED);
+    if (rate == 0 || amount == 0) {
+        return;
+    }
+
+    uint64_t cost = (uint64_t) ((double) amount * 1e9 / rate);
+    uint64_t now = monotonic_ns();
+    uint64_t empty_at = __atomic_load_n(&the_bucket->empty_at_ns, __ATOMIC_RELAXED);
+    uint64_t new_empty_at;
+    do {
+        // A bucket empty for a long time doesn't give more than the burst
+        new_empty_at = ((empty_at > now) ? empty_at : now) + cost;
+    } while (!__atomic_compare_exchange_n(&the_bucket->empty_at_ns, &empty_at, new_empty_at, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    uint64_t deadline = new_empty_at - THROTTLE_BURST_NS;
+    while (deadline > now) {
+        uint64_t wait = deadline - now;
+        if (wait > THROTTLE_SLICE_NS) {
+            wait = THROTTLE_SLICE_NS;
+        }
+        struct timespec delay = {.tv_sec = wait / 1000000000ULL, .tv_nsec = wait % 1000000000ULL};
+        while (nanosleep(&delay, &delay) != 0);
+
+        now = monotonic_ns();
+        uint64_t new_rate = __atomic_load_n(&the_bucket->rate, __ATOMIC_RELAXED);
+        if (new_rate == 0) {
+            return;
+        }
+        // Same rescaling as the bucket (@see throttle_set_rate)
+        if (new_rate != rate && deadline > now) {
+            deadline = now + (uint64_t) ((double) (deadline - now) * rate / new_rate);
+        }
+        rate = new_rate;
+    }
+}
+
+/*!
+ * @brief throttle_load_limits reads the limits from a file
+ * The file has a limit per line: read=<rate>, write=<rate> or files=<rate> (@see parse_rate). Missing limits are removed.
+ * It only uses async signal safe code, it is called by the SIGHUP handler.
+ * @param path is the path of the file
+ * @return 0 in case of success, -1 else
+ */
+int throttle_load_limits(const char *path) {
+    static const char *names[THROTTLE_BUCKETS_COUNT] = {"read=", "write=", "files="};
+    char content[1024];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t length = read(fd, content, sizeof(content) - 1);
+    close(fd);
+    if (length < 0) {
+        return -1;
+    }
+    content[length] = '\0';
+
+    uint64_t rates[THROTTLE_BUCKETS_COUNT] = {0};
+    char *line = content;
+    while (*line != '\0') {
+        for (int i=0; i<THROTTLE_BUCKETS_COUNT; ++i) {
+            size_t name_length = strlen(names[i]);
+            if (strncmp(line, names[i], name_length) == 0 && parse_rate(line + name_length, &rates[i]) != 0) {
+                return -1;
+            }
+        }
+        char *end = strchr(line, '\n');
+        line = (end == NULL) ? line + strlen(line) : end + 1;
+    }
+    for (int i=0; i<THROTTLE_BUCKETS_COUNT; ++i) {
+        throttle_set_rate(i, rates[i]);
+    }
+    return 0;
+}
+
+/*!
+ * @brief reload_limits is the SIGHUP handler, it reloads the limits file
+ * @param signal_number is the received signal
+ */
+static void reload_limits(int signal_number) {
+    int saved_errno = errno;
+    if (throttle_load_limits(limits_path) != 0) {
+        static const char message[] = "Limits file could not be reloaded\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+    }
+    errno = saved_errno;
+}
+
+/*!
+ * @brief throttle_watch_limits loads the limits from a file, and reloads them when the process receives SIGHUP
+ * @param path is the path of the file (@see throttle_load_limits)
+ * @return 0 in case of success, -1 if the file could not be loaded
+ */
+int throttle_watch_limits(const char *path) {
+    if (strlen(path) >= sizeof(limits_path)) {
+        return -1;
+    }
+    strcpy(limits_path, path);
+    if (throttle_load_limits(limits_path) != 0) {
+        return -1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = reload_limits;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+    return 0;
+}
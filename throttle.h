@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Limits are token buckets shared by all the processes (@see prepare), a rate of 0 means no limit
+typedef enum {
+    THROTTLE_READ_BYTES,
+    THROTTLE_WRITE_BYTES,
+    THROTTLE_FILES,
+    THROTTLE_BUCKETS_COUNT
+} throttle_bucket_id_t;
+
+// Consumption allowed in advance of the rate, so that short bursts don't wait
+#define THROTTLE_BURST_NS 100000000ULL
+// Longest sleep between two readings of the rate, so that a changed limit applies to the waiting consumers
+#define THROTTLE_SLICE_NS 100000000ULL
+
+typedef struct {
+    uint64_t rate; // Units per second
+    uint64_t empty_at_ns; // Time at which all the consumed units are paid for at the rate
+} throttle_bucket_t;
+
+typedef struct {
+    throttle_bucket_t buckets[THROTTLE_BUCKETS_COUNT];
+} throttle_t;
+
+int parse_rate(const char *text, uint64_t *rate);
+void throttle_attach(throttle_t *storage);
+void throttle_detach(void);
+void throttle_set_rate(throttle_bucket_id_t bucket, uint64_t rate);
+bool is_throttled(void);
+void throttle_consume(throttle_bucket_id_t bucket, uint64_t amount);
+int throttle_load_limits(const char *path);
+int throttle_watch_limits(const char *path);
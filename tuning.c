@@ -0,0 +1,187 @@
+#include <tuning.h>
+#include <defines.h>
+#include <utility.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// Maximum number of analyzers of a side, processes counts are stored on 8 bits
+#define MAX_ANALYZERS_COUNT 64
+
+/*!
+ * @brief read_sys_int reads an integer from a sysfs file
+ * @param directory is the directory of the file
+ * @param name is the name of the file
+ * @param value is a pointer to the read value
+ * @return 0 in case of success, -1 else
+ */
+static int read_sys_int(const char *directory, const char *name, int *value) {
+    char path[PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int result = (fscanf(file, "%d", value) == 1) ? 0 : -1;
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief get_storage_info finds the block device of a directory and reads its characteristics
+ * The device is found in /sys/dev/block from the device number, partitions are resolved to their disk.
+ * @param path is the path of the directory
+ * @param info is a pointer to the characteristics to fill
+ * @return 0 if the device was found, -1 else (info is then marked as unknown)
+ */
+int get_storage_info(const char *path, storage_info_t *info) {
+    memset(info, 0, sizeof(storage_info_t));
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        return -1;
+    }
+
+    char device_link[64];
+    char device_path[PATH_MAX];
+    snprintf(device_link, sizeof(device_link), "/sys/dev/block/%u:%u", major(path_stat.st_dev), minor(path_stat.st_dev));
+    if (realpath(device_link, device_path) == NULL) {
+        return -1;
+    }
+    // A partition has no queue of its own, it uses the one of its disk
+    int partition;
+    if (read_sys_int(device_path, "partition", &partition) == 0) {
+        char *parent = strrchr(device_path, '/');
+        if (parent != NULL) {
+            *parent = '\0';
+        }
+    }
+
+    char queue_path[PATH_MAX + 8];
+    int rotational;
+    snprintf(queue_path, sizeof(queue_path), "%s/queue", device_path);
+    if (read_sys_int(queue_path, "rotational", &rotational) != 0) {
+        return -1;
+    }
+    if (read_sys_int(queue_path, "nr_requests", &info->queue_depth) != 0) {
+        info->queue_depth = 1;
+    }
+    char *disk = strrchr(device_path, '/');
+    snprintf(info->disk, sizeof(info->disk), "%.63s", (disk == NULL) ? device_path : disk + 1);
+    info->is_rotational = rotational != 0;
+    info->is_known = true;
+    return 0;
+}
+
+/*!
+ * @brief side_capacity gives the number of analyzers a storage can keep busy
+ * A rotational disk seeks for each concurrent reader, so it gets a single one. Other devices get one per request
+ * of their queue. Unknown storages (memory filesystems) are limited by the processors only.
+ * @param info is a pointer to the characteristics of the storage
+ * @return the number of analyzers
+ */
+static int side_capacity(storage_info_t *info) {
+    if (!info->is_known) {
+        return MAX_ANALYZERS_COUNT;
+    }
+    if (info->is_rotational) {
+        return 1;
+    }
+    return (info->queue_depth < MAX_ANALYZERS_COUNT) ? info->queue_depth : MAX_ANALYZERS_COUNT;
+}
+
+/*!
+ * @brief choose_analyzers_counts chooses the number of analyzers of each side (-n auto)
+ * Both sides are analyzed at the same time, so they share the online processors. Each side gets half of them, capped
+ * by what its storage can take, and the share a side can't use goes to the other one.
+ * When both sides are on the same rotational disk, each side gets a single analyzer.
+ * @param source is the path of the source directory
+ * @param destination is the path of the destination directory
+ * @param source_count is a pointer to the number of source analyzers
+ * @param destination_count is a pointer to the number of destination analyzers
+ */
+void choose_analyzers_counts(const char *source, const char *destination, uint8_t *source_count, uint8_t *destination_count) {
+    storage_info_t source_info, destination_info;
+    get_storage_info(source, &source_info);
+    get_storage_info(destination, &destination_info);
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 2) {
+        processors = 2;
+    }
+    int source_capacity = side_capacity(&source_info);
+    int destination_capacity = side_capacity(&destination_info);
+
+    // Both sides on the same disk share its queue too
+    bool same_disk = source_info.is_known && destination_info.is_known && strcmp(source_info.disk, destination_info.disk) == 0;
+    if (same_disk && !source_info.is_rotational) {
+        source_capacity = (source_capacity > 1) ? source_capacity / 2 : 1;
+        destination_capacity = source_capacity;
+    }
+
+    int half = processors / 2;
+    int source_analyzers = (source_capacity < half) ? source_capacity : half;
+    int destination_analyzers = (destination_capacity < processors - source_analyzers) ? destination_capacity : processors - source_analyzers;
+    // The source gets the share the destination can't use
+    source_analyzers = (source_capacity < processors - destination_analyzers) ? source_capacity : processors - destination_analyzers;
+
+    *source_count = (source_analyzers > 0) ? source_analyzers : 1;
+    *destination_count = (destination_analyzers > 0) ? destination_analyzers : 1;
+}
+
+/*!
+ * @brief init_window_tuner starts tuning a window at its maximum
+ * @param tuner is a pointer to the tuner
+ * @param max_window is the maximum window (the number of analyzers)
+ */
+void init_window_tuner(window_tuner_t *tuner, int max_window) {
+    tuner->max_window = (max_window > 0) ? max_window : 1;
+    tuner->window = tuner->max_window;
+    tuner->direction = -1;
+    tuner->last_throughput = 0;
+    tuner->period_start = monotonic_ns();
+    tuner->period_work = 0;
+}
+
+/*!
+ * @brief window_tuner_record counts completed work, and changes the window at the end of each period
+ * The window is moved one step at a time in its current direction while the throughput grows, and the direction is
+ * reversed when it drops (hill climbing). Changes within the tolerance keep the window.
+ * @param tuner is a pointer to the tuner
+ * @param work is the amount of completed work (e.g. bytes analyzed)
+ * @return the window to use
+ */
+int window_tuner_record(window_tuner_t *tuner, uint64_t work) {
+    tuner->period_work += work;
+    uint64_t now = monotonic_ns();
+    if (now - tuner->period_start < TUNING_PERIOD_NS) {
+        return tuner->window;
+    }
+
+    double throughput = (double) tuner->period_work * 1e9 / (now - tuner->period_start);
+    if (tuner->last_throughput > 0) {
+        if (throughput < tuner->last_throughput * (1 - TUNING_TOLERANCE)) {
+            tuner->direction = -tuner->direction;
+        } else if (throughput <= tuner->last_throughput * (1 + TUNING_TOLERANCE)) {
+            tuner->last_throughput = throughput;
+            tuner->period_start = now;
+            tuner->period_work = 0;
+            return tuner->window;
+        }
+    }
+    tuner->window += tuner->direction;
+    if (tuner->window < 1) {
+        tuner->window = 1;
+        tuner->direction = 1;
+    } else if (tuner->window > tuner->max_window) {
+        tuner->window = tuner->max_window;
+        tuner->direction = -1;
+    }
+    tuner->last_throughput = throughput;
+    tuner->period_start = now;
+    tuner->period_work = 0;
+    return tuner->window;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Characteristics of the storage of a directory, read from /sys/block
+typedef struct {
+    bool is_known; // False when the directory is not on a block device (e.g. tmpfs)
+    bool is_rotational;
+    int queue_depth;
+    char disk[64]; // Name of the whole disk, to tell if two directories share it
+} storage_info_t;
+
+// The analysis window is tuned by steps of this duration
+#define TUNING_PERIOD_NS 250000000ULL
+// Throughput changes smaller than this ratio are considered noise
+#define TUNING_TOLERANCE 0.05
+
+// Number of analysis requests kept in flight by a lister, tuned from the measured throughput
+typedef struct {
+    int window;
+    int max_window;
+    int direction; // -1 or 1, direction of the next change of the window
+    double last_throughput;
+    uint64_t period_start;
+    uint64_t period_work;
+} window_tuner_t;
+
+int get_storage_info(const char *path, storage_info_t *info);
+void choose_analyzers_counts(const char *source, const char *destination, uint8_t *source_count, uint8_t *destination_count);
+void init_window_tuner(window_tuner_t *tuner, int max_window);
+int window_tuner_record(window_tuner_t *tuner, uint64_t work);
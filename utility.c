@@ -2,11 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 /*!
  * @brief concat_path concatenates suffix to prefix into result
  * It checks if prefix ends by / and adds this token if necessary
- * It also checks that result will fit into PATH_SIZE length
+ * It checks that result will fit into PATH_SIZE length before writing it, result is left unchanged otherwise
  * @param result the result of the concatenation
  * @param prefix the first part of the resulting path
  * @param suffix the second part of the resulting path
@@ -19,21 +21,80 @@ char *concat_path(char *result, const char *prefix, const char *suffix) {
   }
 
   size_t prefix_len = strlen(prefix);
+  size_t suffix_len = strlen(suffix);
+  // ajoute "/" si le préfixe ne se termine pas par "/"
+  size_t separator_len = (prefix_len > 0 && prefix[prefix_len - 1] != '/') ? 1 : 0;
 
-  // Vérifier si le préfixe se termine par "/"
-  if (prefix_len > 0 && prefix[prefix_len - 1] != '/') {
-    strcat(result, prefix);
-    strcat(result, "/");
-  } else {
-    strcat(result, prefix);
-  }
-
-  strcat(result, suffix); // Ajouter le suffixe
-
-  if (strlen(result) >= PATH_SIZE) {
+  // la taille est vérifiée avant d'écrire quoi que ce soit dans result
+  if (prefix_len + separator_len + suffix_len >= PATH_SIZE) {
     fprintf(stderr, "Erreur : Le chemin résultant dépasse la taille maximale\n");
     return NULL;
   }
 
+  memcpy(result, prefix, prefix_len);
+  if (separator_len > 0) {
+    result[prefix_len] = '/';
+  }
+  memcpy(result + prefix_len + separator_len, suffix, suffix_len + 1);
+
   return result;
 }
+
+/*!
+ * @brief relative_path gives the path of a listed entry relatively to the root of its tree
+ * Entries are listed as "root/relative/path" (@see make_list)
+ * @param path the full path of the entry
+ * @param root the root of the tree the entry belongs to
+ * @return a pointer inside path to the relative part
+ */
+char *relative_path(char *path, char *root) {
+  size_t root_len = strlen(root);
+  if (strncmp(path, root, root_len) != 0) {
+    return path;
+  }
+  path += root_len;
+  while (*path == '/') {
+    ++path;
+  }
+  return path;
+}
+
+/*!
+ * @brief write_string writes a string preceded by its length
+ * @param stream is the stream to write into
+ * @param string is the string to write
+ * @return 0 in case of success, -1 else
+ */
+int write_string(FILE *stream, char *string) {
+  uint16_t length = strlen(string);
+  if (fwrite(&length, sizeof(length), 1, stream) != 1 || fwrite(string, 1, length, stream) != length) {
+    return -1;
+  }
+  return 0;
+}
+
+/*!
+ * @brief read_string reads a string written by write_string
+ * @param stream is the stream to read from
+ * @param string is the buffer receiving the string
+ * @param size is the size of the buffer
+ * @return 0 in case of success, -1 else
+ */
+int read_string(FILE *stream, char *string, size_t size) {
+  uint16_t length;
+  if (fread(&length, sizeof(length), 1, stream) != 1 || length >= size || fread(string, 1, length, stream) != length) {
+    return -1;
+  }
+  string[length] = '\0';
+  return 0;
+}
+
+/*!
+ * @brief monotonic_ns reads the monotonic clock
+ * @return the time in nanoseconds
+ */
+uint64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
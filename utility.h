@@ -1,5 +1,12 @@
 #pragma once
 
 #include <defines.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
-char *concat_path(char *result, char *prefix, char *suffix);
\ No newline at end of file
+char *concat_path(char *result, char *prefix, char *suffix);
+char *relative_path(char *path, char *root);
+int write_string(FILE *stream, char *string);
+int read_string(FILE *stream, char *string, size_t size);
+uint64_t monotonic_ns(void);
@@ -0,0 +1,633 @@
+#include <watch.h>
+#include <sync.h>
+#include <digest-index.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <defines.h>
+#include <filter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+// Changes are synchronized once no event was received for WATCH_DEBOUNCE_MS,
+// or WATCH_MAX_DELAY_MS after the first pending change when events never stop.
+#define WATCH_DEBOUNCE_MS 500
+#define WATCH_MAX_DELAY_MS 5000
+#define WATCH_EVENTS (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+typedef struct _path_node {
+    char *path; // Path relative to the root of the tree
+    files_list_entry_t *entry;
+    struct _path_node *next;
+} path_node_t;
+
+// Hash map from a relative path to its list entry (or to nothing, for the set of pending changes)
+typedef struct {
+    path_node_t **buckets;
+    size_t buckets_count;
+    size_t count;
+} path_map_t;
+
+typedef struct {
+    configuration_t *the_config;
+    process_context_t *p_context;
+    files_list_t *source_list;
+    files_list_t *destination_list;
+    path_map_t source_map;
+    path_map_t destination_map;
+    path_map_t pending_changes;
+    digest_index_t destination_index; // Contents of the destination, so that moves in the source are renamed
+    bool uses_index;
+    bool needs_rescan;
+    int inotify_fd;
+    char **watched_dirs; // Path of the directory of each watch descriptor
+    int watched_dirs_count;
+} watch_state_t;
+
+static volatile sig_atomic_t watch_stop = 0;
+
+/*!
+ * @brief stop_watching is the handler of the signals stopping the watch mode
+ * @param signal is the received signal
+ */
+static void stop_watching(int signal) {
+    watch_stop = 1;
+}
+
+/*!
+ * @brief path_hash computes the FNV-1a hash of a path
+ * @param path is the path to hash
+ * @return the hash value
+ */
+static size_t path_hash(char *path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *path != '\0'; ++path) {
+        hash = (hash ^ (uint8_t) *path) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief path_map_init initializes an empty map
+ * @param map is a pointer to the map
+ * @return 0 in case of success, -1 else
+ */
+static int path_map_init(path_map_t *map) {
+    map->count = 0;
+    map->buckets_count = 1024;
+    map->buckets = calloc(map->buckets_count, sizeof(path_node_t *));
+    return (map->buckets == NULL) ? -1 : 0;
+}
+
+/*!
+ * @brief path_map_clear removes all the elements of a map, the entries are not freed
+ * @param map is a pointer to the map
+ */
+static void path_map_clear(path_map_t *map) {
+    for (size_t i=0; i<map->buckets_count; ++i) {
+        while (map->buckets[i] != NULL) {
+            path_node_t *tmp = map->buckets[i];
+            map->buckets[i] = tmp->next;
+            free(tmp->path);
+            free(tmp);
+        }
+    }
+    map->count = 0;
+}
+
+/*!
+ * @brief path_map_find looks up for a path in a map
+ * @param map is a pointer to the map
+ * @param path is the relative path to look for
+ * @return the node of the path, NULL if there is none
+ */
+static path_node_t *path_map_find(path_map_t *map, char *path) {
+    for (path_node_t *cursor = map->buckets[path_hash(path) % map->buckets_count]; cursor != NULL; cursor = cursor->next) {
+        if (strcmp(cursor->path, path) == 0) {
+            return cursor;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief path_map_put associates an entry to a path, replacing the previous one if any
+ * The map grows when it holds twice more elements than buckets.
+ * @param map is a pointer to the map
+ * @param path is the relative path (it is copied)
+ * @param entry is the entry to associate
+ * @return 0 in case of success, -1 else
+ */
+static int path_map_put(path_map_t *map, char *path, files_list_entry_t *entry) {
+    path_node_t *node = path_map_find(map, path);
+    if (node != NULL) {
+        node->entry = entry;
+        return 0;
+    }
+
+    if (map->count >= 2 * map->buckets_count) {
+        size_t buckets_count = 2 * map->buckets_count;
+        path_node_t **buckets = calloc(buckets_count, sizeof(path_node_t *));
+        if (buckets != NULL) {
+            for (size_t i=0; i<map->buckets_count; ++i) {
+                while (map->buckets[i] != NULL) {
+                    path_node_t *tmp = map->buckets[i];
+                    map->buckets[i] = tmp->next;
+                    tmp->next = buckets[path_hash(tmp->path) % buckets_count];
+                    buckets[path_hash(tmp->path) % buckets_count] = tmp;
+                }
+            }
+            free(map->buckets);
+            map->buckets = buckets;
+            map->buckets_count = buckets_count;
+        }
+    }
+
+    node = malloc(sizeof(path_node_t));
+    if (node == NULL || (node->path = strdup(path)) == NULL) {
+        free(node);
+        return -1;
+    }
+    size_t bucket = path_hash(path) % map->buckets_count;
+    node->entry = entry;
+    node->next = map->buckets[bucket];
+    map->buckets[bucket] = node;
+    ++map->count;
+    return 0;
+}
+
+/*!
+ * @brief path_map_remove removes a path from a map
+ * @param map is a pointer to the map
+ * @param path is the relative path to remove
+ */
+static void path_map_remove(path_map_t *map, char *path) {
+    path_node_t **link = &map->buckets[path_hash(path) % map->buckets_count];
+    for (; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->path, path) == 0) {
+            path_node_t *tmp = *link;
+            *link = tmp->next;
+            free(tmp->path);
+            free(tmp);
+            --map->count;
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief index_list adds all the entries of a list to a map
+ * @param map is a pointer to the map
+ * @param list is a pointer to the list
+ * @param root is the root of the listed tree
+ */
+static void index_list(path_map_t *map, files_list_t *list, char *root) {
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        path_map_put(map, relative_path(cursor->path_and_name, root), cursor);
+    }
+}
+
+/*!
+ * @brief record_destination updates the destination list after a source entry was synchronized
+ * @param state is a pointer to the watch state
+ * @param source_entry is the synchronized source entry
+ */
+static void record_destination(watch_state_t *state, files_list_entry_t *source_entry) {
+    char *path = relative_path(source_entry->path_and_name, state->the_config->source);
+    path_node_t *node = path_map_find(&state->destination_map, path);
+    files_list_entry_t *destination_entry = (node != NULL) ? node->entry : NULL;
+
+    if (destination_entry == NULL) {
+        files_list_entry_t new_entry;
+        if (concat_path(new_entry.path_and_name, state->the_config->destination, path) == NULL || add_entry_to_tail(state->destination_list, &new_entry) != 0) {
+            return;
+        }
+        destination_entry = state->destination_list->tail;
+        path_map_put(&state->destination_map, path, destination_entry);
+    } else if (state->uses_index) {
+        // l'entrée est retrouvée dans l'index par son ancien contenu
+        remove_from_digest_index(&state->destination_index, destination_entry);
+    }
+    destination_entry->mtime = source_entry->mtime;
+    destination_entry->size = source_entry->size;
+    destination_entry->mode = source_entry->mode;
+    destination_entry->entry_type = source_entry->entry_type;
+    memcpy(destination_entry->md5sum, source_entry->md5sum, sizeof(destination_entry->md5sum));
+    memcpy(destination_entry->fingerprint, source_entry->fingerprint, sizeof(destination_entry->fingerprint));
+    if (state->uses_index) {
+        add_to_digest_index(&state->destination_index, destination_entry, false);
+    }
+}
+
+/*!
+ * @brief index_destination indexes the contents of the destination files
+ * The files without counterpart in the source are orphans, they can be renamed (@see relocate_from_index).
+ * @param state is a pointer to the watch state, with its maps filled
+ */
+static void index_destination(watch_state_t *state) {
+    if (!state->uses_index) {
+        return;
+    }
+    for (files_list_entry_t *cursor = state->destination_list->head; cursor != NULL; cursor = cursor->next) {
+        bool is_orphan = path_map_find(&state->source_map, relative_path(cursor->path_and_name, state->the_config->destination)) == NULL;
+        add_to_digest_index(&state->destination_index, cursor, is_orphan);
+    }
+}
+
+/*!
+ * @brief forget_source_path removes a path of the source, and all the paths under it, from the source list
+ * Nothing is removed from the destination, but its files at these paths become orphans: they are renamed if their
+ * content appears at another path of the source, which is how moves in the source are synchronized.
+ * @param state is a pointer to the watch state
+ * @param path is the removed path, relative to the source
+ */
+static void forget_source_path(watch_state_t *state, char *path) {
+    path_node_t *source_node = path_map_find(&state->source_map, path);
+    if (source_node == NULL) {
+        return;
+    }
+    // seuls les dossiers ont des entrées sous leur chemin
+    bool is_file = source_node->entry->entry_type == FICHIER;
+    size_t length = strlen(path);
+    files_list_entry_t *cursor = is_file ? source_node->entry : state->source_list->head;
+    while (cursor != NULL) {
+        files_list_entry_t *next = is_file ? NULL : cursor->next;
+        char *relative = relative_path(cursor->path_and_name, state->the_config->source);
+        if (strncmp(relative, path, length) == 0 && (relative[length] == '\0' || relative[length] == '/')) {
+            path_node_t *destination_node = path_map_find(&state->destination_map, relative);
+            digest_index_node_t *index_node = (state->uses_index && destination_node != NULL) ? find_entry_in_digest_index(&state->destination_index, destination_node->entry) : NULL;
+            if (index_node != NULL) {
+                index_node->is_orphan = true;
+            }
+            path_map_remove(&state->source_map, relative);
+            remove_entry_from_list(state->source_list, cursor);
+        }
+        cursor = next;
+    }
+}
+
+/*!
+ * @brief move_destination_entry records that a destination file was renamed to the path of a source file
+ * @param state is a pointer to the watch state
+ * @param previous_path is the former path of the destination file
+ * @param path is its new path, relative to the destination
+ */
+static void move_destination_entry(watch_state_t *state, char *previous_path, char *path) {
+    char *previous = relative_path(previous_path, state->the_config->destination);
+    path_node_t *moved_node = path_map_find(&state->destination_map, previous);
+    if (moved_node == NULL) {
+        return;
+    }
+    files_list_entry_t *moved_entry = moved_node->entry;
+    path_map_remove(&state->destination_map, previous);
+    // le fichier remplacé par le renommage n'existe plus
+    path_node_t *replaced_node = path_map_find(&state->destination_map, path);
+    if (replaced_node != NULL && replaced_node->entry != moved_entry) {
+        remove_from_digest_index(&state->destination_index, replaced_node->entry);
+        remove_entry_from_list(state->destination_list, replaced_node->entry);
+    }
+    path_map_put(&state->destination_map, path, moved_entry);
+}
+
+/*!
+ * @brief add_watches watches a directory and all its sub directories
+ * Its entries are also marked as changed: a directory created or moved in the source comes with its content.
+ * @param state is a pointer to the watch state
+ * @param dir_path is the path of the directory
+ * @param mark_changed tells if the entries of the directory must be marked as changed
+ */
+static void add_watches(watch_state_t *state, char *dir_path, bool mark_changed) {
+    int wd = inotify_add_watch(state->inotify_fd, dir_path, WATCH_EVENTS);
+    if (wd < 0) {
+        perror(dir_path);
+        return;
+    }
+    if (wd >= state->watched_dirs_count) {
+        int count = (wd + 1) * 2;
+        char **watched_dirs = realloc(state->watched_dirs, count * sizeof(char *));
+        if (watched_dirs == NULL) {
+            return;
+        }
+        memset(watched_dirs + state->watched_dirs_count, 0, (count - state->watched_dirs_count) * sizeof(char *));
+        state->watched_dirs = watched_dirs;
+        state->watched_dirs_count = count;
+    }
+    free(state->watched_dirs[wd]);
+    state->watched_dirs[wd] = strdup(dir_path);
+
+    DIR *dir = open_dir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char path[PATH_SIZE];
+    while ((entry = get_next_entry(dir)) != NULL) {
+        if (concat_path(path, dir_path, entry->d_name) == NULL) {
+            continue;
+        }
+        if (is_filtered_out(relative_path(path, state->the_config->source), entry->d_type == DT_DIR)) {
+            continue;
+        }
+        if (mark_changed) {
+            path_map_put(&state->pending_changes, relative_path(path, state->the_config->source), NULL);
+        }
+        if (entry->d_type == DT_DIR) {
+            add_watches(state, path, mark_changed);
+        }
+    }
+    closedir(dir);
+}
+
+/*!
+ * @brief synchronize_path synchronizes one changed path of the source
+ * The entry goes through the same steps as in a complete synchronization: stats (and MD5), comparison with the
+ * destination entry, then rename or link of a destination file with the same content, or copy, when they mismatch.
+ * Removed entries are only removed from the source list, with the entries under them (@see forget_source_path).
+ * @param state is a pointer to the watch state
+ * @param path is the path of the entry, relative to the source
+ */
+static void synchronize_path(watch_state_t *state, char *path) {
+    configuration_t *the_config = state->the_config;
+    path_node_t *source_node = path_map_find(&state->source_map, path);
+    files_list_entry_t entry;
+    struct stat entry_stat;
+
+    memset(&entry, 0, sizeof(entry));
+    if (concat_path(entry.path_and_name, the_config->source, path) == NULL) {
+        return;
+    }
+    // les entrées supprimées, exclues, ou qui ne sont plus ni des fichiers ni des dossiers, sont oubliées
+    if (lstat(entry.path_and_name, &entry_stat) != 0 || !(S_ISREG(entry_stat.st_mode) || S_ISDIR(entry_stat.st_mode)) || is_filtered_out(path, S_ISDIR(entry_stat.st_mode)) || get_file_stats(&entry) != 0) {
+        forget_source_path(state, path);
+        return;
+    }
+
+    // mise à jour de la liste source
+    if (source_node != NULL) {
+        files_list_entry_t *source_entry = source_node->entry;
+        entry.prev = source_entry->prev;
+        entry.next = source_entry->next;
+        memcpy(source_entry, &entry, sizeof(entry));
+    } else if (add_entry_to_tail(state->source_list, &entry) == 0) {
+        path_map_put(&state->source_map, path, state->source_list->tail);
+    }
+
+    path_node_t *destination_node = path_map_find(&state->destination_map, path);
+    if (destination_node == NULL || mismatch(&entry, destination_node->entry, the_config->uses_md5)) {
+        // un fichier déplacé dans la source est renommé dans la destination, comme dans une synchronisation complète
+        char previous_path[PATH_SIZE];
+        if (entry.entry_type == FICHIER && state->uses_index && relocate_from_index(&entry, &state->destination_index, the_config, previous_path)) {
+            if (previous_path[0] != '\0') {
+                move_destination_entry(state, previous_path, path);
+            }
+            if (!the_config->is_dry_run) {
+                record_destination(state, &entry);
+            }
+        } else if (copy_entry_to_destination(&entry, the_config) == 0 && !the_config->is_dry_run) {
+            if (the_config->is_verifying && entry.entry_type == FICHIER) {
+                verify_copy(&entry, the_config);
+            }
+            record_destination(state, &entry);
+        }
+    }
+}
+
+/*!
+ * @brief compare_paths compares two pending paths, for qsort
+ * @param lhd is a pointer to the first path
+ * @param rhd is a pointer to the second path
+ * @return the result of strcmp
+ */
+static int compare_paths(const void *lhd, const void *rhd) {
+    return strcmp(*(char * const *) lhd, *(char * const *) rhd);
+}
+
+/*!
+ * @brief synchronize_pending_changes synchronizes the changes collected since the last synchronization
+ * Removed paths are processed first, then the others in path order, so that a directory is created before its content
+ * is copied.
+ * After an events queue overflow, changes were lost: both trees are completely listed and synchronized again.
+ * @param state is a pointer to the watch state
+ */
+static void synchronize_pending_changes(watch_state_t *state) {
+    configuration_t *the_config = state->the_config;
+
+    if (state->needs_rescan) {
+        if (the_config->is_verbose) {
+            printf("Events were lost, synchronizing both trees again\n");
+        }
+        files_list_t differences_list = {NULL, NULL};
+        path_map_clear(&state->source_map);
+        path_map_clear(&state->destination_map);
+        path_map_clear(&state->pending_changes);
+        clear_files_list(state->source_list);
+        clear_files_list(state->destination_list);
+        if (state->uses_index) {
+            clear_digest_index(&state->destination_index);
+            state->uses_index = init_digest_index(&state->destination_index, 0) == 0;
+        }
+        state->needs_rescan = false;
+
+        // des dossiers ont pu être créés sans être surveillés
+        add_watches(state, the_config->source, false);
+        synchronize_trees(the_config, state->p_context, state->source_list, state->destination_list, &differences_list);
+        index_list(&state->source_map, state->source_list, the_config->source);
+        index_list(&state->destination_map, state->destination_list, the_config->destination);
+        index_destination(state);
+        if (!the_config->is_dry_run) {
+            for (files_list_entry_t *cursor = differences_list.head; cursor != NULL; cursor = cursor->next) {
+                record_destination(state, cursor);
+            }
+        }
+        clear_files_list(&differences_list);
+        return;
+    }
+
+    char **paths = malloc(state->pending_changes.count * sizeof(char *));
+    if (paths == NULL) {
+        state->needs_rescan = true;
+        return;
+    }
+    size_t count = 0;
+    for (size_t i=0; i<state->pending_changes.buckets_count; ++i) {
+        for (path_node_t *cursor = state->pending_changes.buckets[i]; cursor != NULL; cursor = cursor->next) {
+            paths[count++] = cursor->path;
+        }
+    }
+    qsort(paths, count, sizeof(char *), compare_paths);
+    // les suppressions d'abord : les fichiers qu'elles laissent dans la destination peuvent alors être renommés vers
+    // les chemins créés, quel que soit leur ordre
+    char path[PATH_SIZE];
+    struct stat path_stat;
+    for (int pass=0; pass<2; ++pass) {
+        for (size_t i=0; i<count; ++i) {
+            bool exists = concat_path(path, the_config->source, paths[i]) != NULL && lstat(path, &path_stat) == 0;
+            if (exists == (pass == 1)) {
+                synchronize_path(state, paths[i]);
+            }
+        }
+    }
+    free(paths);
+    path_map_clear(&state->pending_changes);
+}
+
+/*!
+ * @brief read_events reads the available inotify events and records the changed paths
+ * @param state is a pointer to the watch state
+ */
+static void read_events(watch_state_t *state) {
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length = read(state->inotify_fd, buffer, sizeof(buffer));
+    char path[PATH_SIZE];
+
+    for (char *cursor = buffer; length > 0 && cursor < buffer + length; ) {
+        struct inotify_event *event = (struct inotify_event *) cursor;
+        cursor += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            state->needs_rescan = true;
+            continue;
+        }
+        if (event->wd < 0 || event->wd >= state->watched_dirs_count || state->watched_dirs[event->wd] == NULL) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            // le dossier surveillé a été supprimé
+            free(state->watched_dirs[event->wd]);
+            state->watched_dirs[event->wd] = NULL;
+            continue;
+        }
+        if (event->len == 0 || strncmp(event->name, STATE_FILES_PREFIX, strlen(STATE_FILES_PREFIX)) == 0) {
+            continue;
+        }
+        if (concat_path(path, state->watched_dirs[event->wd], event->name) == NULL) {
+            continue;
+        }
+        path_map_put(&state->pending_changes, relative_path(path, state->the_config->source), NULL);
+        if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && !is_filtered_out(relative_path(path, state->the_config->source), true)) {
+            add_watches(state, path, true);
+        }
+    }
+}
+
+/*!
+ * @brief elapsed_ms gives the time elapsed since a given time
+ * @param since is the start time (CLOCK_MONOTONIC)
+ * @return the elapsed time in milliseconds
+ */
+static long elapsed_ms(struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*!
+ * @brief watch_source keeps the destination synchronized with the source, until SIGINT or SIGTERM is received
+ * It is called after a complete synchronization, with its lists. The source tree is watched with inotify, and only
+ * the changed paths are synchronized (@see synchronize_path), so that the cost is proportional to the changes.
+ * Changes are debounced (@see WATCH_DEBOUNCE_MS), and both trees are synchronized again when events are lost.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param source_list is a pointer to the source list
+ * @param destination_list is a pointer to the destination list
+ * @param differences_list is a pointer to the differences list that was applied. It is cleared.
+ */
+void watch_source(configuration_t *the_config, process_context_t *p_context, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list) {
+    watch_state_t state = {
+        .the_config = the_config,
+        .p_context = p_context,
+        .source_list = source_list,
+        .destination_list = destination_list,
+        .needs_rescan = false,
+        .watched_dirs = NULL,
+        .watched_dirs_count = 0,
+    };
+    struct sigaction action = {.sa_handler = stop_watching};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    state.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.inotify_fd < 0) {
+        perror("inotify_init1");
+        return;
+    }
+    if (path_map_init(&state.source_map) != 0 || path_map_init(&state.destination_map) != 0 || path_map_init(&state.pending_changes) != 0) {
+        fprintf(stderr, "Not enough memory to watch %s\n", the_config->source);
+        close(state.inotify_fd);
+        return;
+    }
+
+    index_list(&state.source_map, source_list, the_config->source);
+    index_list(&state.destination_map, destination_list, the_config->destination);
+    // index des contenus de la destination, seulement si les sommes MD5 sont calculées
+    state.uses_index = the_config->uses_md5 && init_digest_index(&state.destination_index, 0) == 0;
+    index_destination(&state);
+    if (!the_config->is_dry_run) {
+        for (files_list_entry_t *cursor = differences_list->head; cursor != NULL; cursor = cursor->next) {
+            record_destination(&state, cursor);
+        }
+    }
+    clear_files_list(differences_list);
+    add_watches(&state, the_config->source, false);
+    if (the_config->is_verbose) {
+        printf("Watching %s\n", the_config->source);
+    }
+
+    struct timespec first_change, last_event;
+    clock_gettime(CLOCK_MONOTONIC, &last_event);
+    first_change = last_event;
+    struct pollfd poll_fd = {.fd = state.inotify_fd, .events = POLLIN};
+    while (!watch_stop) {
+        bool has_changes = state.pending_changes.count > 0 || state.needs_rescan;
+        int timeout = -1;
+        if (has_changes) {
+            long quiet = WATCH_DEBOUNCE_MS - elapsed_ms(&last_event);
+            long late = WATCH_MAX_DELAY_MS - elapsed_ms(&first_change);
+            timeout = (quiet < late) ? quiet : late;
+            if (timeout <= 0) {
+                synchronize_pending_changes(&state);
+                continue;
+            }
+        }
+
+        int ready = poll(&poll_fd, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (ready > 0) {
+            read_events(&state);
+            clock_gettime(CLOCK_MONOTONIC, &last_event);
+            if (!has_changes) {
+                first_change = last_event;
+            }
+        }
+    }
+
+    // les changements en attente sont synchronisés avant de quitter
+    if (state.pending_changes.count > 0 && !state.needs_rescan) {
+        synchronize_pending_changes(&state);
+    }
+    path_map_clear(&state.source_map);
+    path_map_clear(&state.destination_map);
+    path_map_clear(&state.pending_changes);
+    free(state.source_map.buckets);
+    free(state.destination_map.buckets);
+    free(state.pending_changes.buckets);
+    if (state.uses_index) {
+        clear_digest_index(&state.destination_index);
+    }
+    for (int i=0; i<state.watched_dirs_count; ++i) {
+        free(state.watched_dirs[i]);
+    }
+    free(state.watched_dirs);
+    close(state.inotify_fd);
+}
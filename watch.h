@@ -0,0 +1,7 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <processes.h>
+
+void watch_source(configuration_t *the_config, process_context_t *p_context, files_list_t *source_list, files_list_t *destination_list, files_list_t *differences_list);